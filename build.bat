@@ -4,7 +4,7 @@ set BaseFile1="task1.cpp"
 set MsvcLinkFlags=-incremental:no -opt:ref -machine:x64 -manifest:no
 set MsvcCompileFlags=-Zi -Zo -Gy -GF -GR- -EHs- -EHc- -EHa- -WX -W4 -nologo -FC -diagnostics:column -fp:except- -fp:fast -wd4100 -wd4189 -wd4201 -wd4505 -wd4996 -arch:AVX
 
-set ClangCompileFlags=-Wno-missing-braces -Wno-writable-strings -Wno-unused-function -mavx
+set ClangCompileFlags=-Wno-missing-braces -Wno-writable-strings -Wno-unused-function -mavx -mf16c
 
 
 echo -----------------
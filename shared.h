@@ -1,12 +1,14 @@
 #pragma comment(lib, "User32.lib") // basic windows functionality
 #pragma comment(lib, "Gdi32.lib") // gdi graphics
 #pragma comment(lib, "UxTheme.lib") // for gdi backbuffer
+#pragma comment(lib, "Advapi32.lib") // for large page privilege
 
 #define WIN32_LEAN_AND_MEAN
 #include "Windows.h"
 #include "uxtheme.h"
 #include "stdio.h"
 #include "stdlib.h"
+#include "malloc.h"
 #include "math.h"
 
 #include "inttypes.h"
@@ -34,6 +36,7 @@ typedef s32 b32;
 #define pick_smaller(a, b) (((a) > (b)) ? (b) : (a))
 #define pick_bigger(a, b) (((a) > (b)) ? (a) : (b))
 #define array_count(a) ((sizeof(a))/(sizeof(*a)))
+#define align_bin_to(Value, AlignToPow2Number) (((Value) + ((AlignToPow2Number)-1)) & ~((AlignToPow2Number)-1))
 
 
 
@@ -143,6 +146,77 @@ static v3 clamp01(v3 value)
 
 
 
+////////////////////////////////
+// IEEE half float <-> float without F16C, for tails of SIMD loops and non-AVX builds.
+// Round to nearest even, handles denormals, infinities and NaNs.
+union Float_Bits
+{
+    f32 f;
+    u32 u;
+};
+
+static u16 half_from_f32(f32 value)
+{
+    Float_Bits f32_infinity = {}; f32_infinity.u = 255 << 23;
+    Float_Bits f16_max = {};      f16_max.u = (127 + 16) << 23;
+    Float_Bits denorm_magic = {}; denorm_magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+    
+    Float_Bits bits = {};
+    bits.f = value;
+    u32 sign = bits.u & 0x8000'0000;
+    bits.u ^= sign;
+    
+    u32 result = 0;
+    if (bits.u >= f16_max.u)
+    {
+        result = (bits.u > f32_infinity.u) ? 0x7E00 : 0x7C00; // NaN stays NaN, the rest becomes infinity
+    }
+    else if (bits.u < (113 << 23))
+    {
+        // half denormal or zero - adding the magic value lines the mantissa up at the bottom
+        // and the addition itself does the rounding
+        bits.f += denorm_magic.f;
+        result = bits.u - denorm_magic.u;
+    }
+    else
+    {
+        u32 mantissa_odd = (bits.u >> 13) & 1;
+        bits.u += ((u32)(15 - 127) << 23) + 0xFFF;
+        bits.u += mantissa_odd;
+        result = bits.u >> 13;
+    }
+    
+    result |= sign >> 16;
+    return (u16)result;
+}
+
+static f32 f32_from_half(u16 value)
+{
+    Float_Bits magic = {};
+    magic.u = 113 << 23;
+    u32 shifted_exponent = 0x7C00 << 13;
+    
+    Float_Bits result = {};
+    result.u = (u32)(value & 0x7FFF) << 13;
+    u32 exponent = shifted_exponent & result.u;
+    result.u += (127 - 15) << 23;
+    
+    if (exponent == shifted_exponent) // infinity or NaN
+    {
+        result.u += (128 - 16) << 23;
+    }
+    else if (exponent == 0) // zero or denormal
+    {
+        result.u += 1 << 23;
+        result.f -= magic.f;
+    }
+    
+    result.u |= (u32)(value & 0x8000) << 16;
+    return result.f;
+}
+
+
+
 ////////////////////////////////
 static s64 time_perf()
 {
@@ -388,3 +462,359 @@ static v3 rgb_from_hsl(Color_Hsl color)
     res.b += m;
     return res;
 }
+
+
+
+
+////////////////////////////////
+struct Mapped_File
+{
+    HANDLE file;
+    HANDLE mapping;
+    u8 *memory;
+    u64 size;
+};
+
+static Mapped_File map_file(char *path, b32 copy_on_write)
+{
+    Mapped_File result = {};
+    
+    // FILE_FLAG_SEQUENTIAL_SCAN is the closest thing to MADV_SEQUENTIAL - it makes cache manager read ahead more aggressively
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER file_size = {};
+        
+        // mapping of an empty file fails anyway
+        if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, (copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY),
+                                                0, 0, nullptr);
+            if (mapping)
+            {
+                void *memory = MapViewOfFile(mapping, (copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ), 0, 0, 0);
+                if (memory)
+                {
+                    result.file = file;
+                    result.mapping = mapping;
+                    result.memory = (u8 *)memory;
+                    result.size = (u64)file_size.QuadPart;
+                }
+                else
+                {
+                    CloseHandle(mapping);
+                }
+            }
+        }
+        
+        if (!result.memory)
+        {
+            CloseHandle(file);
+        }
+    }
+    
+    return result;
+}
+
+static Mapped_File map_file_read_only(char *path)
+{
+    Mapped_File result = map_file(path, false);
+    return result;
+}
+
+// Writes to the view stay private to the process (like MAP_PRIVATE) - the file is never modified
+static Mapped_File map_file_copy_on_write(char *path)
+{
+    Mapped_File result = map_file(path, true);
+    return result;
+}
+
+static void prefetch_mapped_file(Mapped_File *file)
+{
+    // Asynchronous read-ahead of the whole view (MADV_WILLNEED equivalent).
+    // It returns immediately so the I/O overlaps with whatever we do next.
+    if (file->memory)
+    {
+        WIN32_MEMORY_RANGE_ENTRY range = {};
+        range.VirtualAddress = file->memory;
+        range.NumberOfBytes = file->size;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+}
+
+static void unmap_file(Mapped_File *file)
+{
+    if (file->memory)
+    {
+        UnmapViewOfFile(file->memory);
+        CloseHandle(file->mapping);
+        CloseHandle(file->file);
+    }
+    *file = {};
+}
+
+
+// Keeps reading until size bytes arrived (pipes return partial reads); returns less only at the end of input
+static u64 read_file_all(HANDLE file, void *data, u64 size)
+{
+    u8 *at = (u8 *)data;
+    u64 result = 0;
+    while (result < size)
+    {
+        DWORD chunk_size = (DWORD)pick_smaller(size - result, (u64)(1u << 30));
+        DWORD read = 0;
+        if (!ReadFile(file, at + result, chunk_size, &read, nullptr) || !read)
+        {
+            break;
+        }
+        
+        result += read;
+    }
+    return result;
+}
+
+static b32 write_file_all(HANDLE file, void *data, u64 size)
+{
+    u8 *at = (u8 *)data;
+    while (size)
+    {
+        DWORD chunk_size = (DWORD)pick_smaller(size, (u64)(1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(file, at, chunk_size, &written, nullptr) || !written)
+        {
+            return false;
+        }
+        
+        at += written;
+        size -= written;
+    }
+    return true;
+}
+
+
+
+
+
+////////////////////////////////
+// Reserves a big range of address space up front and commits pages as it grows.
+// Committed pages stay committed after arena_reset so reusing the arena doesn't page fault again.
+struct Memory_Arena
+{
+    u8 *base;
+    u64 reserved_size;
+    u64 committed_size;
+    u64 used;
+    u64 last_allocation; // offset of the most recent allocation - this one can be resized in place
+};
+
+#define Arena_Commit_Granularity (1024*1024)
+
+static Memory_Arena arena_create(u64 reserve_size)
+{
+    Memory_Arena arena = {};
+    arena.base = (u8 *)VirtualAlloc(nullptr, reserve_size, MEM_RESERVE, PAGE_READWRITE);
+    if (arena.base)
+    {
+        arena.reserved_size = reserve_size;
+    }
+    return arena;
+}
+
+static b32 arena_commit(Memory_Arena *arena, u64 size)
+{
+    if (size > arena->reserved_size)
+    {
+        return false;
+    }
+    
+    if (size > arena->committed_size)
+    {
+        u64 commit_size = pick_smaller(align_bin_to(size, (u64)Arena_Commit_Granularity), arena->reserved_size);
+        if (!VirtualAlloc(arena->base + arena->committed_size, commit_size - arena->committed_size,
+                          MEM_COMMIT, PAGE_READWRITE))
+        {
+            return false;
+        }
+        arena->committed_size = commit_size;
+    }
+    
+    return true;
+}
+
+static void *arena_push(Memory_Arena *arena, u64 size, u64 alignment)
+{
+    void *result = nullptr;
+    u64 offset = align_bin_to(arena->used, alignment);
+    
+    if (arena_commit(arena, offset + size))
+    {
+        result = arena->base + offset;
+        arena->last_allocation = offset;
+        arena->used = offset + size;
+    }
+    return result;
+}
+
+static b32 arena_owns(Memory_Arena *arena, void *memory)
+{
+    b32 result = ((u8 *)memory >= arena->base &&
+                  (u8 *)memory < arena->base + arena->reserved_size);
+    return result;
+}
+
+static b32 arena_is_last(Memory_Arena *arena, void *memory)
+{
+    b32 result = ((u8 *)memory == arena->base + arena->last_allocation &&
+                  arena->used > arena->last_allocation);
+    return result;
+}
+
+// Only the most recent allocation can be resized
+static b32 arena_resize_last(Memory_Arena *arena, void *memory, u64 new_size)
+{
+    b32 result = false;
+    if (arena_is_last(arena, memory) &&
+        arena_commit(arena, arena->last_allocation + new_size))
+    {
+        arena->used = arena->last_allocation + new_size;
+        result = true;
+    }
+    return result;
+}
+
+static void arena_pop_last(Memory_Arena *arena, void *memory)
+{
+    if (arena_is_last(arena, memory))
+    {
+        arena->used = arena->last_allocation;
+    }
+}
+
+static void arena_reset(Memory_Arena *arena)
+{
+    arena->used = 0;
+    arena->last_allocation = 0;
+}
+
+
+
+
+
+////////////////////////////////
+// Large pages need SeLockMemoryPrivilege ("Lock pages in memory" in the local security policy)
+// and it has to be enabled in the process token before the first allocation.
+// There are no transparent huge pages on Windows - large page allocations are
+// committed, physically backed and locked up front.
+static b32 enable_large_pages()
+{
+    b32 result = false;
+    
+    HANDLE token = nullptr;
+    if (GetLargePageMinimum() &&
+        OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+    {
+        TOKEN_PRIVILEGES privileges = {};
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        
+        if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid))
+        {
+            // succeeds even if the privilege wasn't assigned - last error tells us if it really got enabled
+            AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr);
+            result = (GetLastError() == ERROR_SUCCESS);
+        }
+        CloseHandle(token);
+    }
+    
+    return result;
+}
+
+static void *allocate_large_pages(u64 size)
+{
+    u64 page_size = GetLargePageMinimum();
+    void *result = nullptr;
+    if (page_size)
+    {
+        result = VirtualAlloc(nullptr, align_bin_to(size, page_size),
+                              MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    return result;
+}
+
+
+
+
+////////////////////////////////
+// Windows has no MAP_POPULATE - freshly committed pages get faulted in one by one on first touch.
+// Touch them up front from a few threads so the page faults don't land in the code we measure.
+struct Prefault_Range
+{
+    u8 *memory;
+    u64 size;
+};
+
+#define Page_Size 4096
+#define Prefault_Bytes_Per_Thread (4ull*1024*1024)
+#define Prefault_Max_Threads 8
+
+static DWORD WINAPI prefault_thread(void *parameter)
+{
+    Prefault_Range *range = (Prefault_Range *)parameter;
+    for (u64 offset = 0; offset < range->size; offset += Page_Size)
+    {
+        ((u8 volatile *)range->memory)[offset] = 0;
+    }
+    return 0;
+}
+
+// Only for fresh allocations - it overwrites one byte per page with 0
+static void prefault_pages(void *memory, u64 size)
+{
+    SYSTEM_INFO system_info = {};
+    GetSystemInfo(&system_info);
+    
+    u64 thread_count = size / Prefault_Bytes_Per_Thread;
+    thread_count = pick_smaller(thread_count, (u64)system_info.dwNumberOfProcessors);
+    thread_count = pick_smaller(thread_count, (u64)Prefault_Max_Threads);
+    thread_count = pick_bigger(thread_count, 1ull);
+    
+    u64 chunk_size = align_bin_to(size / thread_count, (u64)Page_Size);
+    
+    Prefault_Range ranges[Prefault_Max_Threads] = {};
+    HANDLE threads[Prefault_Max_Threads] = {};
+    u32 started_count = 0;
+    
+    for (u64 i = 0; i < thread_count; i += 1)
+    {
+        u64 offset = pick_smaller(i*chunk_size, size);
+        ranges[i].memory = (u8 *)memory + offset;
+        ranges[i].size = pick_smaller(chunk_size, size - offset);
+    }
+    
+    // the calling thread takes the first range itself
+    for (u64 i = 1; i < thread_count; i += 1)
+    {
+        HANDLE thread = CreateThread(nullptr, 0, prefault_thread, &ranges[i], 0, nullptr);
+        if (thread)
+        {
+            threads[started_count] = thread;
+            started_count += 1;
+        }
+        else
+        {
+            prefault_thread(&ranges[i]);
+        }
+    }
+    
+    prefault_thread(&ranges[0]);
+    
+    if (started_count)
+    {
+        WaitForMultipleObjects(started_count, threads, TRUE, INFINITE);
+        for (u32 i = 0; i < started_count; i += 1)
+        {
+            CloseHandle(threads[i]);
+        }
+    }
+}
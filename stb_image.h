@@ -3783,6 +3783,11 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
     j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 #endif
+
+#ifdef STBI_JPEG_YCBCR_TO_RGB_KERNEL
+    // caller supplied color conversion (e.g. one that writes a different channel order)
+    j->YCbCr_to_RGB_kernel = STBI_JPEG_YCBCR_TO_RGB_KERNEL;
+#endif
 }
 
 // clean up the temporary component buffers
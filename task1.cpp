@@ -11,23 +11,84 @@
   It is the least correct one but it was the fastest, looks mostly OK and was the easiest to implement for my AVX version :D
 
   convert_image is implemented both as normal C++ code and has an analogous version in manually written AVX intrinsics.
+  At saturation 0 convert_image switches to a kernel that computes the luminance once per pixel.
+  At saturation 1 it only moves bytes; convert_image_ops has kernels specialized for any subset of swap/flip/saturate.
   I picked AVX because it is the newest SIMD extension that my CPU supports (Ivy Bridge).
   AVX is a little weird because it doesn't support 256 bit wide integer operations so in reality it is a mix of AVX and SSE.
   
   
   Controls:
-  C - convert_image()
-  B - benchmark - calls convert_image() 245 times
-  R - reload image.png from disk
+  C - convert_image(); the window shows the output's mean luminance, mean chroma and clipped pixels, gathered
+      in the same pass (also for 3-6 and 8)
+  B - benchmark - calls convert_image() 245 times; first iteration after a reload is reported as cold
+  R - reload image.png (or the image passed on the command line) from disk
   [ - decrease saturation variable by 0.1
   ] - increase saturation variable by 0.1
   BACKSPACE - reset saturation variable to 1.0
+  A - auto saturation - sets the saturation variable from a sparse pass over the image (target mean chroma,
+      at most 1% clipped pixels), then converts like C with plain saturation
+  V - toggle vibrance - C and B boost (or cut) the saturation weighted by how unsaturated each pixel already is,
+      the saturation variable is the vibrance amount; 16-bit, HDR and packed 24-bit images keep plain saturation
+  S - toggle scrub mode - [, ] and BACKSPACE immediately show convert_image(saturation) of the image as it was
+      when S was pressed, rendered from luminance/chroma planes made once; any other key leaves scrub mode
+  L - toggle linear light - C and B saturate in linear light (like 6, but in the fused AVX swap/flip/saturate loop
+      with table transfer functions); turns vibrance off and V turns this off
+  H - toggle large page image buffers (needs "Lock pages in memory" privilege) and reload
+  P - toggle prefaulting fresh image buffers in parallel and reload
+  K - toggle the decoded pixel cache (<image path>.bgra next to the image) and reload
+  O - toggle packed 24-bit pixels for opaque images and reload - C, B, 1 and 2 work on 3 bytes per pixel
+      (25% less memory traffic) and the display is refreshed from them; keys 3-8 drop to 32-bit pixels
   1 - swap Red and Blue bytes
   2 - flip image vertically
   3 - saturate image in HSV space
   4 - saturate image in HSL space
   5 - saturate image using relative luminance
   6 - saturate image using relative luminance in linear color space
+  7 - like 6 but in a persistent half float linear buffer - repeated presses skip the sRGB conversions
+      and don't lose precision in between; any other edit drops the buffer
+  8 - saturate image in Oklab (perceptual; scales the OkLCh chroma, keeps lightness and hue) - SIMD with
+      a vectorized cube root, within a small multiple of convert_image
+  
+  16-bit PNGs are kept at full precision: C, B, 1 and 2 run 16 bits per channel versions of the kernels
+  and the displayed 8-bit image is refreshed from them. Keys 3-8 drop to the 8-bit image.
+  Radiance .hdr images work the same way with linear float planes; C only saturates them
+  (no clipping) and the display is a tone mapped (luminance Reinhard) version.
+  JPEGs are decoded with stb_image.h's SSE2 IDCT and our own YCbCr -> BGRA row kernel,
+  so they come out already swapped and only get flipped. The window shows how long the last load took.
+  In batch mode JPEGs are saturated in YCbCr (scaling Cb and Cr around 128) while they decode,
+  for saturation 0 - 4, and only get the swap and flip of convert_image.
+  Raw NV12 and I420 frames (limited range BT.601) open by extension - .nv12, .i420 or .yuv (I420) -
+  with the size in the file name, e.g. capture_1920x1080.nv12. They go to bottom-up BGRA in one pass
+  with saturation in YCbCr; in batch mode that replaces convert_image.
+  
+  
+  Command line:
+  task1.exe [image path] - open a different image than image.png
+  task1.exe -batch [-saturation value] [-cache] [-packed] [-gray] paths... - load (memory mapped) and convert_image every file,
+                                                                             decode and convert timings are printed to stdout;
+                                                                             -cache uses the decoded pixel cache,
+                                                                             -packed keeps opaque images as packed 24-bit BGR,
+                                                                             -gray only writes an 8-bit luminance plane per image (<path>.gray.pgm)
+  task1.exe -batch [...] -vibrance value paths... - convert_image with vibrance instead of saturation
+  task1.exe -batch [...] -linear paths... - convert_image with the saturation in linear light
+  task1.exe -batch [...] -sweep count paths... - contact sheet of count renders at saturations 0 - 2 per image,
+                                                 stacked top to bottom in <path>.sweep.ppm
+  task1.exe -batch [...] -auto [-auto-chroma value] [-auto-clip fraction] paths... - saturation picked per image for
+                                           a target mean chroma (default 64) and clip budget (default 0.01),
+                                           also for -vibrance and -linear; not with -gray, -sweep, adjustments or -lut
+  task1.exe -batch [...] -stats paths... - luminance histogram (mean, 1%/50%/99%), mean chroma and clipped pixels of
+                                           every output and of all of them, gathered inside the convert_image pass
+                                           (plain and -vibrance 8-bit images; the other paths say they have none)
+  task1.exe -batch [...] [-hue degrees] [-brightness value] [-contrast value] [-white-balance r g b] paths...
+                                                                           - the adjustments and -saturation are multiplied into
+                                                                             one color matrix that is applied with the swap and flip
+  task1.exe -batch [...] -lut file.cube paths... - 3D LUT (tetrahedral interpolation) with the color matrix baked into it,
+                                                   still one pass with the swap and flip
+  task1.exe -stream [-saturation value] <width>x<height> - raw BGRA frames from stdin -> saturation and flip -> stdout
+                                                          as BGRA; reading, converting and writing run on separate threads
+  task1.exe -stream [-saturation value] y4m - same for 8-bit 4:2:0 YUV4MPEG2 input, also flipped BGRA frames out
+  task1.exe -stream [-saturation value] -premultiplied <width>x<height> - BGRA frames with premultiplied alpha,
+                                                                         saturated without unpremultiplying them
 */
 
 // Benchmark in release mode (245 iterations); lowest time:
@@ -54,7 +115,197 @@
 
 
 
-__forceinline static u32 convert_pixel(u32 value, f32 saturation)
+////////////////////////////////
+// Per image statistics for QA, accumulated by the conversion kernels in the same pass over the pixels
+// (convert_image_stats, image_saturate) instead of a second one. They describe the output pixels:
+// a histogram of the Rec. 709 luminance, the mean chroma (max - min channel) and how many pixels
+// had a channel clamped by the saturation.
+struct Image_Stats
+{
+    u64 pixel_count;
+    u64 clipped_count;
+    f64 chroma_sum;
+    u64 luminance_histogram[256];
+};
+
+// r, g and b are the output channels (0-255)
+__forceinline static void image_stats_add(Image_Stats *stats, u32 r, u32 g, u32 b, b32 clipped)
+{
+    u32 luminance = (u32)((f32)r*0.2126f + (f32)g*0.7152f + (f32)b*0.0722f);
+    stats->luminance_histogram[pick_smaller(luminance, 255u)] += 1;
+    stats->chroma_sum += (f64)(pick_bigger(pick_bigger(r, g), b) - pick_smaller(pick_smaller(r, g), b));
+    stats->clipped_count += (clipped ? 1 : 0);
+    stats->pixel_count += 1;
+}
+
+// Totals over several images (or over parts of one converted separately)
+static void image_stats_merge(Image_Stats *into, Image_Stats *from)
+{
+    into->pixel_count += from->pixel_count;
+    into->clipped_count += from->clipped_count;
+    into->chroma_sum += from->chroma_sum;
+    for (u32 i = 0; i < 256; i += 1)
+    {
+        into->luminance_histogram[i] += from->luminance_histogram[i];
+    }
+}
+
+static f32 image_stats_mean_chroma(Image_Stats *stats)
+{
+    f32 result = (stats->pixel_count ? (f32)(stats->chroma_sum / (f64)stats->pixel_count) : 0.f);
+    return result;
+}
+
+static f32 image_stats_mean_luminance(Image_Stats *stats)
+{
+    f64 sum = 0;
+    for (u32 i = 0; i < 256; i += 1)
+    {
+        sum += (f64)i*(f64)stats->luminance_histogram[i];
+    }
+    f32 result = (stats->pixel_count ? (f32)(sum / (f64)stats->pixel_count) : 0.f);
+    return result;
+}
+
+// Lowest luminance that at least fraction of the pixels are at or below
+static u32 image_stats_luminance_percentile(Image_Stats *stats, f32 fraction)
+{
+    u64 target = (u64)((f64)fraction*(f64)stats->pixel_count);
+    u64 count = 0;
+    u32 result = 0;
+    for (; result < 255; result += 1)
+    {
+        count += stats->luminance_histogram[result];
+        if (count > 0 && count >= target)
+        {
+            break;
+        }
+    }
+    return result;
+}
+
+#if Use_Avx
+// The part of Image_Stats that the SIMD kernels keep in registers and on the stack while they run;
+// merged into Image_Stats once at the end, so the stats cost no extra memory traffic over the image.
+#define Image_Stats_Lanes_Buffer_Size 4096
+
+struct Image_Stats_Lanes
+{
+    // Luminance bytes of the last pixels. They go into the histogram in a tight loop when the buffer
+    // is full - scattered increments inside the conversion loop were slower than a second pass.
+    u8 luminance[Image_Stats_Lanes_Buffer_Size];
+    u32 luminance_count;
+    u32 histograms[4][256]; // a copy per lane group so increments of equal neighbours don't wait on each other
+    
+    // Whole numbers, exact in f32 for one buffer of pixels - flushed into the f64 totals with it
+    __m256 chroma;
+    __m256 clipped;
+    __m256 invalid; // lanes past the end of a row: they are in the luminance bytes as 0s
+    f64 chroma_sum;
+    f64 clipped_count;
+    f64 invalid_counts[4]; // per histogram copy - lane i of every 8 ends up in copy i % 4
+};
+
+static void image_stats_lanes_begin(Image_Stats_Lanes *lanes)
+{
+    lanes->luminance_count = 0;
+    memset(lanes->histograms, 0, sizeof(lanes->histograms));
+    lanes->chroma = _mm256_setzero_ps();
+    lanes->clipped = _mm256_setzero_ps();
+    lanes->invalid = _mm256_setzero_ps();
+    lanes->chroma_sum = 0;
+    lanes->clipped_count = 0;
+    for (u32 copy = 0; copy < 4; copy += 1)
+    {
+        lanes->invalid_counts[copy] = 0;
+    }
+}
+
+static void image_stats_lanes_flush(Image_Stats_Lanes *lanes)
+{
+    f32 chroma[8];
+    f32 clipped[8];
+    f32 invalid[8];
+    _mm256_storeu_ps(chroma, lanes->chroma);
+    _mm256_storeu_ps(clipped, lanes->clipped);
+    _mm256_storeu_ps(invalid, lanes->invalid);
+    for (u32 lane = 0; lane < 8; lane += 1)
+    {
+        lanes->chroma_sum += chroma[lane];
+        lanes->clipped_count += clipped[lane];
+        lanes->invalid_counts[lane % 4] += invalid[lane];
+    }
+    lanes->chroma = _mm256_setzero_ps();
+    lanes->clipped = _mm256_setzero_ps();
+    lanes->invalid = _mm256_setzero_ps();
+}
+
+static void image_stats_lanes_histogram(Image_Stats_Lanes *lanes)
+{
+    u8 *luminance = lanes->luminance;
+    u32 count = lanes->luminance_count;
+    for (u32 i = 0; i < count; i += 4)
+    {
+        lanes->histograms[0][luminance[i]] += 1;
+        lanes->histograms[1][luminance[i + 1]] += 1;
+        lanes->histograms[2][luminance[i + 2]] += 1;
+        lanes->histograms[3][luminance[i + 3]] += 1;
+    }
+    lanes->luminance_count = 0;
+    image_stats_lanes_flush(lanes);
+}
+
+// r, g and b are the output channels as whole number floats, clipped and valid are lane masks
+__forceinline static void image_stats_lanes_add_8(Image_Stats_Lanes *lanes, __m256 r, __m256 g, __m256 b,
+                                                  __m256 clipped, __m256 valid)
+{
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.2126f)), _mm256_mul_ps(g, _mm256_set1_ps(0.7152f)));
+    luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, _mm256_set1_ps(0.0722f)));
+    luminance = _mm256_and_ps(luminance, valid);
+    __m256 chroma = _mm256_sub_ps(_mm256_max_ps(_mm256_max_ps(r, g), b), _mm256_min_ps(_mm256_min_ps(r, g), b));
+    lanes->chroma = _mm256_add_ps(lanes->chroma, _mm256_and_ps(chroma, valid));
+    lanes->clipped = _mm256_add_ps(lanes->clipped, _mm256_and_ps(_mm256_and_ps(clipped, valid), value1));
+    lanes->invalid = _mm256_add_ps(lanes->invalid, _mm256_andnot_ps(valid, value1));
+    
+    // truncated and saturated to bytes like the scalar version
+    __m256i index = _mm256_cvttps_epi32(luminance);
+    __m128i words = _mm_packus_epi32(_mm256_extractf128_si256(index, 0), _mm256_extractf128_si256(index, 1));
+    _mm_storel_epi64((__m128i*)&lanes->luminance[lanes->luminance_count], _mm_packus_epi16(words, words));
+    lanes->luminance_count += 8;
+    if (lanes->luminance_count == Image_Stats_Lanes_Buffer_Size)
+    {
+        image_stats_lanes_histogram(lanes);
+    }
+}
+
+static void image_stats_lanes_end(Image_Stats_Lanes *lanes, Image_Stats *stats)
+{
+    image_stats_lanes_histogram(lanes);
+    
+    // the lanes past the end of rows went into bin 0 of their own copy
+    for (u32 copy = 0; copy < 4; copy += 1)
+    {
+        u32 invalid_count = (u32)lanes->invalid_counts[copy];
+        assert(lanes->histograms[copy][0] >= invalid_count);
+        lanes->histograms[copy][0] -= invalid_count;
+    }
+    
+    stats->clipped_count += (u64)lanes->clipped_count;
+    stats->chroma_sum += lanes->chroma_sum;
+    for (u32 i = 0; i < 256; i += 1)
+    {
+        u32 count = (lanes->histograms[0][i] + lanes->histograms[1][i] +
+                     lanes->histograms[2][i] + lanes->histograms[3][i]);
+        stats->luminance_histogram[i] += count;
+        stats->pixel_count += count;
+    }
+}
+#endif
+
+
+// convert_pixel that also tells if a channel was clamped; channel_max is 255, or the alpha for premultiplied pixels
+__forceinline static u32 convert_pixel_clipped(u32 value, f32 saturation, f32 channel_max, b32 *clipped)
 {
     v3 source = {
         (f32)((value >> 16) & 0xFF),
@@ -70,9 +321,12 @@ __forceinline static u32 convert_pixel(u32 value, f32 saturation)
     diff *= saturation;
     
     v3 out = (gray + diff);
-    out.x = clamp(0.f, out.x, 255.f);
-    out.y = clamp(0.f, out.y, 255.f);
-    out.z = clamp(0.f, out.z, 255.f);
+    *clipped = (out.x < 0.f || out.x > channel_max ||
+                out.y < 0.f || out.y > channel_max ||
+                out.z < 0.f || out.z > channel_max);
+    out.x = clamp(0.f, out.x, channel_max);
+    out.y = clamp(0.f, out.y, channel_max);
+    out.z = clamp(0.f, out.z, channel_max);
     
     u32 r255 = (u32)out.r;
     u32 g255 = (u32)out.g;
@@ -85,13 +339,292 @@ __forceinline static u32 convert_pixel(u32 value, f32 saturation)
     return result;
 }
 
+__forceinline static u32 convert_pixel(u32 value, f32 saturation)
+{
+    b32 clipped;
+    u32 result = convert_pixel_clipped(value, saturation, 255.f, &clipped);
+    return result;
+}
+
+__forceinline static u32 swap_pixel(u32 value)
+{
+    u32 result = (((value & 0xFF'00'FF'00)      ) |
+                  ((value & 0x00'00'00'FF) << 16) |
+                  ((value & 0x00'FF'00'00) >> 16));
+    return result;
+}
 
-static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
+// Vibrance: the saturation change is weighted by how unsaturated the pixel already is,
+// so dull colors get all of it and colors at full chroma are left alone.
+// channel_max is what full chroma is: 255, or the alpha for premultiplied pixels.
+__forceinline static f32 vibrance_saturation_max(u32 value, f32 vibrance, f32 channel_max)
+{
+    u32 r = (value >> 16) & 0xFF;
+    u32 g = (value >> 8)  & 0xFF;
+    u32 b = value         & 0xFF;
+    f32 chroma = (f32)(pick_bigger(pick_bigger(r, g), b) - pick_smaller(pick_smaller(r, g), b));
+    
+    f32 result = 1.f + (vibrance - 1.f)*(1.f - chroma/pick_bigger(channel_max, 1.f));
+    return result;
+}
+
+__forceinline static f32 vibrance_saturation(u32 value, f32 vibrance)
+{
+    return vibrance_saturation_max(value, vibrance, 255.f);
+}
+
+// convert_pixel with the R/B swap optional (convert_pixel always swaps), saturation or vibrance,
+// and straight or premultiplied alpha (the channels are clamped to the alpha instead of 255)
+template <b32 Swap, b32 Vibrance, b32 Premultiplied>
+__forceinline static u32 convert_pixel_ops(u32 value, f32 saturation)
+{
+    f32 channel_max = (Premultiplied ? (f32)(value >> 24) : 255.f);
+    b32 clipped;
+    u32 result = convert_pixel_clipped(value, Vibrance ? vibrance_saturation_max(value, saturation, channel_max) : saturation,
+                                       channel_max, &clipped);
+    return Swap ? result : swap_pixel(result);
+}
+
+// convert_pixel_ops that adds the output pixel to stats
+template <b32 Swap, b32 Vibrance, b32 Premultiplied>
+__forceinline static u32 convert_pixel_stats(u32 value, f32 saturation, Image_Stats *stats)
+{
+    f32 channel_max = (Premultiplied ? (f32)(value >> 24) : 255.f);
+    b32 clipped;
+    u32 result = convert_pixel_clipped(value, Vibrance ? vibrance_saturation_max(value, saturation, channel_max) : saturation,
+                                       channel_max, &clipped);
+    image_stats_add(stats, result & 0xFF, (result >> 8) & 0xFF, (result >> 16) & 0xFF, clipped);
+    return Swap ? result : swap_pixel(result);
+}
+
+
+////////////////////////////////
+// Saturation 0: every channel becomes the luminance, so it is computed once per pixel and written
+// either as a gray BGRA pixel or as one byte of a single channel plane (4x less to write).
+// Same luminance math and vertical flip as convert_image so the results are identical to convert_image(0).
+__forceinline static u32 luminance_pixel(u32 value)
+{
+    f32 r = (f32)((value >> 16) & 0xFF);
+    f32 g = (f32)((value >> 8)  & 0xFF);
+    f32 b = (f32)(value         & 0xFF);
+    
+    f32 luminance = (r * 0.2126f +
+                     g * 0.7152f +
+                     b * 0.0722f);
+    u32 result = (u32)clamp(0.f, luminance, 255.f);
+    return result;
+}
+
+#if Use_Avx
+// 8 pixels (two registers) -> luminance in 8 u32 lanes
+__forceinline static __m256i luminance_8(__m128i lo, __m128i hi)
+{
+    __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m256 r = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 16), imask_FF),
+                                                    _mm_and_si128(_mm_srli_epi32(hi, 16), imask_FF)));
+    __m256 g = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 8), imask_FF),
+                                                    _mm_and_si128(_mm_srli_epi32(hi, 8), imask_FF)));
+    __m256 b = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(lo, imask_FF),
+                                                    _mm_and_si128(hi, imask_FF)));
+    
+    __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.2126f)),
+                                     _mm256_mul_ps(g, _mm256_set1_ps(0.7152f)));
+    luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, _mm256_set1_ps(0.0722f)));
+    luminance = _mm256_max_ps(_mm256_min_ps(luminance, _mm256_set1_ps(255.f)), _mm256_set1_ps(0.f));
+    
+    __m256i result = _mm256_cvttps_epi32(luminance);
+    return result;
+}
+
+// luminance lanes -> gray pixels with the alpha of the source pixels
+__forceinline static __m128i gray_pixels_4(__m128i luminance, __m128i source)
+{
+    __m128i spread = _mm_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    __m128i alpha = _mm_and_si128(source, _mm_set1_epi32(0xFF00'0000));
+    __m128i result = _mm_or_si128(_mm_shuffle_epi8(luminance, spread), alpha);
+    return result;
+}
+#endif
+
+__forceinline static u32 gray_pixel(u32 value)
+{
+    u32 result = ((value & 0xFF00'0000) | (luminance_pixel(value) * 0x01'01'01));
+    return result;
+}
+
+// In place gray BGRA (alpha is kept); convert_image calls this for saturation 0.
+// Rows are processed in top/bottom pairs either way, Flip only decides where they are stored.
+template <b32 Flip>
+static void convert_image_gray(u32 width, u32 height, u32 *memory)
+{
+    u32 half_height = height / 2;
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u32 *row = memory + y*width;
+        u32 *opposite_row = memory + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        // 4 pixels from the top row and 4 from the bottom row
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i *top_address = (__m128i*)&row[x];
+            __m128i *bot_address = (__m128i*)&opposite_row[x];
+            __m128i top_input = _mm_loadu_si128(top_address);
+            __m128i bot_input = _mm_loadu_si128(bot_address);
+            
+            __m256i luminance = luminance_8(top_input, bot_input);
+            _mm_storeu_si128(Flip ? bot_address : top_address, gray_pixels_4(_mm256_extractf128_si256(luminance, 0), top_input));
+            _mm_storeu_si128(Flip ? top_address : bot_address, gray_pixels_4(_mm256_extractf128_si256(luminance, 1), bot_input));
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u32 row_value = gray_pixel(row[x]);
+            u32 opposite_value = gray_pixel(opposite_row[x]);
+            (Flip ? opposite_row : row)[x] = row_value;
+            (Flip ? row : opposite_row)[x] = opposite_value;
+        }
+    }
+    
+    // middle row for odd heights
+    if (height & 1)
+    {
+        u32 *row = memory + half_height*width;
+        for (u64 x = 0; x < width; x += 1)
+        {
+            row[x] = gray_pixel(row[x]);
+        }
+    }
+}
+
+// Luminance of every pixel as width*height bytes; like convert_image the rows come out flipped.
+// source is not modified.
+static void image_luminance_plane(u32 width, u32 height, u32 *source, u8 *plane)
+{
+    for (u64 y = 0; y < height; y += 1)
+    {
+        u32 *source_row = source + y*width;
+        u8 *plane_row = plane + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i luminance = luminance_8(_mm_loadu_si128((__m128i*)&source_row[x]),
+                                            _mm_loadu_si128((__m128i*)&source_row[x + 4]));
+            __m128i words = _mm_packus_epi32(_mm256_extractf128_si256(luminance, 0),
+                                             _mm256_extractf128_si256(luminance, 1));
+            _mm_storel_epi64((__m128i*)&plane_row[x], _mm_packus_epi16(words, words));
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            plane_row[x] = (u8)luminance_pixel(source_row[x]);
+        }
+    }
+}
+
+
+////////////////////////////////
+// convert_image does the R/B swap, the vertical flip and the saturation in one pass.
+// Callers that want only some of it go through convert_image_ops, which picks a kernel that is
+// specialized at compile time, so the work that is not needed is not in the loop at all:
+//   saturation 0      -> convert_image_gray (one luminance per pixel)
+//   saturation 1 / no -> convert_image_shuffle (bytes are only moved, no float math)
+//   anything else     -> convert_image_saturate
+// Swap, Flip and Vibrance are template parameters; the branches on them are resolved by the compiler.
+enum Convert_Ops
+{
+    Convert_Swap     = 0x1, // RGBA <-> BGRA
+    Convert_Flip     = 0x2, // upside down (GDI bottom-up rows)
+    Convert_Saturate = 0x4,
+    Convert_Vibrance = 0x8, // with Convert_Saturate: the saturation value is a vibrance (see vibrance_saturation)
+    Convert_Linear   = 0x10, // with Convert_Saturate: saturation in linear light (convert_image_saturate_linear)
+    Convert_Premultiplied = 0x20, // with Convert_Saturate: the color channels are premultiplied by alpha
+    
+    Convert_All = Convert_Swap | Convert_Flip | Convert_Saturate,
+};
+
+// Swap and/or flip without touching the color values; memory bound like a memcpy
+template <b32 Swap, b32 Flip>
+static void convert_image_shuffle(u32 width, u32 height, u32 *memory)
+{
+    u32 half_height = height / 2;
+    
+#if Use_Avx
+    __m128i swap_mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+#endif
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u32 *row = memory + y*width;
+        u32 *opposite_row = memory + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i *top_address = (__m128i*)&row[x];
+            __m128i *bot_address = (__m128i*)&opposite_row[x];
+            __m128i top0 = _mm_loadu_si128(top_address);
+            __m128i top1 = _mm_loadu_si128(top_address + 1);
+            __m128i bot0 = _mm_loadu_si128(bot_address);
+            __m128i bot1 = _mm_loadu_si128(bot_address + 1);
+            
+            top0 = Swap ? _mm_shuffle_epi8(top0, swap_mask) : top0;
+            top1 = Swap ? _mm_shuffle_epi8(top1, swap_mask) : top1;
+            bot0 = Swap ? _mm_shuffle_epi8(bot0, swap_mask) : bot0;
+            bot1 = Swap ? _mm_shuffle_epi8(bot1, swap_mask) : bot1;
+            
+            _mm_storeu_si128(Flip ? bot_address : top_address, top0);
+            _mm_storeu_si128(Flip ? bot_address + 1 : top_address + 1, top1);
+            _mm_storeu_si128(Flip ? top_address : bot_address, bot0);
+            _mm_storeu_si128(Flip ? top_address + 1 : bot_address + 1, bot1);
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u32 row_value = Swap ? swap_pixel(row[x]) : row[x];
+            u32 opposite_value = Swap ? swap_pixel(opposite_row[x]) : opposite_row[x];
+            (Flip ? opposite_row : row)[x] = row_value;
+            (Flip ? row : opposite_row)[x] = opposite_value;
+        }
+    }
+    
+    // middle row for odd heights
+    if (Swap && (height & 1))
+    {
+        u32 *row = memory + half_height*width;
+        for (u64 x = 0; x < width; x += 1)
+        {
+            row[x] = swap_pixel(row[x]);
+        }
+    }
+}
+
+// Alpha is kept. Saturation is linear around the luminance, so for premultiplied pixels it is the same
+// math with the channels clamped to the alpha instead of 255 (and vibrance measuring chroma against the alpha).
+// With Stats the output pixels are also added to stats (see Image_Stats)
+template <b32 Swap, b32 Flip, b32 Vibrance, b32 Premultiplied, b32 Stats>
+static void convert_image_saturate_kernel(u32 width, u32 height, u32 *memory, float saturation, Image_Stats *stats)
 {
     u32 half_height = height / 2;
+    Image_Stats *gather = (Stats ? stats : nullptr); // null in the instances without stats, so that code goes away
     
 #if Use_Avx
+    Image_Stats_Lanes lanes;
+    if (gather)
+    {
+        image_stats_lanes_begin(&lanes);
+    }
+    
     __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m128i imask_alpha = _mm_set1_epi32(0xFF00'0000);
     __m128i imask_full = _mm_set1_epi32(~0);
     __m128i imask_0 = _mm_set1_epi32(0);
     
@@ -101,6 +634,9 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
     __m256 saturation_wide = _mm256_set1_ps(saturation);
     __m256 value0 = _mm256_set1_ps(0.f);
     __m256 value255 = _mm256_set1_ps(255.f);
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 vibrance_minus_1 = _mm256_set1_ps(saturation - 1.f);
+    __m256 inv_255 = _mm256_set1_ps(1.f/255.f);
     
     
     __m128i row_ending_clip_masks[] = {
@@ -155,22 +691,44 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
             // {top_g0, top_g1, top_g2, top_g3, bot_g0, bot_g1, bot_g2, bot_g3}
             // {top_b0, top_b1, top_b2, top_b3, bot_b0, bot_b1, bot_b2, bot_b3}
             
+            // Premultiplied: a channel can go up to the alpha of its pixel
+            __m256 channel_max = (Premultiplied ?
+                                  _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_srli_epi32(bot_input, 24), _mm_srli_epi32(top_input, 24))) :
+                                  value255);
+            
             
             // Calculate saturation
             __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
             luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
             
-            __m256 diff_r = _mm256_mul_ps(_mm256_sub_ps(r, luminance), saturation_wide);
-            __m256 diff_g = _mm256_mul_ps(_mm256_sub_ps(g, luminance), saturation_wide);
-            __m256 diff_b = _mm256_mul_ps(_mm256_sub_ps(b, luminance), saturation_wide);
+            // Vibrance: per pixel saturation from the chroma (max - min channel)
+            __m256 chroma = _mm256_sub_ps(_mm256_max_ps(_mm256_max_ps(r, g), b), _mm256_min_ps(_mm256_min_ps(r, g), b));
+            __m256 pixel_saturation = (Vibrance ?
+                                       _mm256_add_ps(value1, _mm256_mul_ps(vibrance_minus_1,
+                                                                           _mm256_sub_ps(value1, Premultiplied ?
+                                                                                         _mm256_div_ps(chroma, _mm256_max_ps(channel_max, value1)) :
+                                                                                         _mm256_mul_ps(chroma, inv_255)))) :
+                                       saturation_wide);
+            
+            __m256 diff_r = _mm256_mul_ps(_mm256_sub_ps(r, luminance), pixel_saturation);
+            __m256 diff_g = _mm256_mul_ps(_mm256_sub_ps(g, luminance), pixel_saturation);
+            __m256 diff_b = _mm256_mul_ps(_mm256_sub_ps(b, luminance), pixel_saturation);
             
             r = _mm256_add_ps(luminance, diff_r);
             g = _mm256_add_ps(luminance, diff_g);
             b = _mm256_add_ps(luminance, diff_b);
             
-            r = _mm256_max_ps(_mm256_min_ps(r, value255), value0);
-            g = _mm256_max_ps(_mm256_min_ps(g, value255), value0);
-            b = _mm256_max_ps(_mm256_min_ps(b, value255), value0);
+            __m256 clipped = value0;
+            if (gather)
+            {
+                __m256 low = _mm256_min_ps(_mm256_min_ps(r, g), b);
+                __m256 high = _mm256_max_ps(_mm256_max_ps(r, g), b);
+                clipped = _mm256_or_ps(_mm256_cmp_ps(low, value0, _CMP_LT_OQ), _mm256_cmp_ps(high, channel_max, _CMP_GT_OQ));
+            }
+            
+            r = _mm256_max_ps(_mm256_min_ps(r, channel_max), value0);
+            g = _mm256_max_ps(_mm256_min_ps(g, channel_max), value0);
+            b = _mm256_max_ps(_mm256_min_ps(b, channel_max), value0);
             
             
             // Going back to u32 color
@@ -178,6 +736,13 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
             __m256i gi = _mm256_cvttps_epi32(g);
             __m256i bi = _mm256_cvttps_epi32(b);
             
+            if (gather)
+            {
+                __m256 valid = _mm256_castsi256_ps(_mm256_setr_m128i(end_clip_mask, end_clip_mask));
+                image_stats_lanes_add_8(&lanes, _mm256_cvtepi32_ps(ri), _mm256_cvtepi32_ps(gi), _mm256_cvtepi32_ps(bi),
+                                        clipped, valid);
+            }
+            
             __m128i bot_ri = _mm256_extractf128_si256(ri, 0);
             __m128i top_ri = _mm256_extractf128_si256(ri, 1);
             __m128i bot_gi = _mm256_extractf128_si256(gi, 0);
@@ -187,11 +752,16 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
             
             bot_gi = _mm_slli_epi32(bot_gi, 8);
             top_gi = _mm_slli_epi32(top_gi, 8);
-            bot_bi = _mm_slli_epi32(bot_bi, 16);
-            top_bi = _mm_slli_epi32(top_bi, 16);
+            // Swap: r goes to the lowest byte, b to the third one
+            bot_ri = Swap ? bot_ri : _mm_slli_epi32(bot_ri, 16);
+            top_ri = Swap ? top_ri : _mm_slli_epi32(top_ri, 16);
+            bot_bi = Swap ? _mm_slli_epi32(bot_bi, 16) : bot_bi;
+            top_bi = Swap ? _mm_slli_epi32(top_bi, 16) : top_bi;
             
             __m128i top_output = _mm_or_si128(_mm_or_si128(top_ri, top_gi), top_bi);
             __m128i bot_output = _mm_or_si128(_mm_or_si128(bot_ri, bot_gi), bot_bi);
+            top_output = _mm_or_si128(top_output, _mm_and_si128(top_input, imask_alpha));
+            bot_output = _mm_or_si128(bot_output, _mm_and_si128(bot_input, imask_alpha));
             
             
             // Masking off the changes at the end of the row for widths that are non-divisible by 4
@@ -199,15 +769,20 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
             bot_output = _mm_and_si128(bot_output, end_clip_mask);
             top_input = _mm_and_si128(top_input, inv_end_clip_mask);
             bot_input = _mm_and_si128(bot_input, inv_end_clip_mask);
-            top_output = _mm_or_si128(top_output, bot_input);
-            bot_output = _mm_or_si128(bot_output, top_input);
+            top_output = _mm_or_si128(top_output, Flip ? bot_input : top_input);
+            bot_output = _mm_or_si128(bot_output, Flip ? top_input : bot_input);
             
             
             // Store the data back + swap top and bottom rows
-            _mm_storeu_si128(bot_address, top_output);
-            _mm_storeu_si128(top_address, bot_output);
+            _mm_storeu_si128(Flip ? bot_address : top_address, top_output);
+            _mm_storeu_si128(Flip ? top_address : bot_address, bot_output);
         }
     }
+    
+    if (gather)
+    {
+        image_stats_lanes_end(&lanes, gather);
+    }
 #else
     for (u64 y = 0; y < half_height; y += 1)
     {
@@ -216,11 +791,13 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
         
         for (u64 x = 0; x < width; x += 1)
         {
-            u32 row_value = convert_pixel(row[x], saturation);
-            u32 opposite_value = convert_pixel(opposite_row[x], saturation);
+            u32 row_value = (gather ? convert_pixel_stats<Swap, Vibrance, Premultiplied>(row[x], saturation, gather) :
+                             convert_pixel_ops<Swap, Vibrance, Premultiplied>(row[x], saturation));
+            u32 opposite_value = (gather ? convert_pixel_stats<Swap, Vibrance, Premultiplied>(opposite_row[x], saturation, gather) :
+                                  convert_pixel_ops<Swap, Vibrance, Premultiplied>(opposite_row[x], saturation));
             
-            opposite_row[x] = row_value;
-            row[x] = opposite_value;
+            (Flip ? opposite_row : row)[x] = row_value;
+            (Flip ? row : opposite_row)[x] = opposite_value;
         }
     }
 #endif
@@ -233,469 +810,5432 @@ static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
         
         for (u64 x = 0; x < width; x += 1)
         {
-            row[x] = convert_pixel(row[x], saturation);
+            row[x] = (gather ? convert_pixel_stats<Swap, Vibrance, Premultiplied>(row[x], saturation, gather) :
+                      convert_pixel_ops<Swap, Vibrance, Premultiplied>(row[x], saturation));
         }
     }
 }
 
+template <b32 Swap, b32 Flip, b32 Vibrance>
+static void convert_image_saturate(u32 width, u32 height, u32 *memory, float saturation, b32 premultiplied, Image_Stats *stats)
+{
+    if (premultiplied)
+    {
+        if (stats) convert_image_saturate_kernel<Swap, Flip, Vibrance, true, true>(width, height, memory, saturation, stats);
+        else       convert_image_saturate_kernel<Swap, Flip, Vibrance, true, false>(width, height, memory, saturation, nullptr);
+    }
+    else
+    {
+        if (stats) convert_image_saturate_kernel<Swap, Flip, Vibrance, false, true>(width, height, memory, saturation, stats);
+        else       convert_image_saturate_kernel<Swap, Flip, Vibrance, false, false>(width, height, memory, saturation, nullptr);
+    }
+}
 
+// Every color channel times scale, rounded and clamped to 255; alpha is kept
+__forceinline static u32 scale_color_channels(u32 value, f32 scale)
+{
+    u32 result = value & 0xFF00'0000;
+    for (u32 shift = 0; shift < 24; shift += 8)
+    {
+        f32 channel = (f32)((value >> shift) & 0xFF)*scale + 0.5f;
+        result |= (u32)pick_smaller(channel, 255.f) << shift;
+    }
+    return result;
+}
 
+#if Use_Avx
+// scale_color_channels for 8 pixels; lo gets lanes 0-3 of scale, hi lanes 4-7
+__forceinline static void scale_color_channels_8(__m128i *lo, __m128i *hi, __m256 scale)
+{
+    __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m128i imask_alpha = _mm_set1_epi32(0xFF00'0000);
+    __m256 value_half = _mm256_set1_ps(0.5f);
+    __m256 value255 = _mm256_set1_ps(255.f);
+    
+    __m256 c0 = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(*lo, imask_FF), _mm_and_si128(*hi, imask_FF)));
+    __m256 c1 = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(*lo, 8), imask_FF),
+                                                     _mm_and_si128(_mm_srli_epi32(*hi, 8), imask_FF)));
+    __m256 c2 = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(*lo, 16), imask_FF),
+                                                     _mm_and_si128(_mm_srli_epi32(*hi, 16), imask_FF)));
+    
+    __m256i i0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(c0, scale), value_half), value255));
+    __m256i i1 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(c1, scale), value_half), value255));
+    __m256i i2 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(c2, scale), value_half), value255));
+    
+    *lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(*lo, imask_alpha), _mm256_extractf128_si256(i0, 0)),
+                       _mm_or_si128(_mm_slli_epi32(_mm256_extractf128_si256(i1, 0), 8),
+                                    _mm_slli_epi32(_mm256_extractf128_si256(i2, 0), 16)));
+    *hi = _mm_or_si128(_mm_or_si128(_mm_and_si128(*hi, imask_alpha), _mm256_extractf128_si256(i0, 1)),
+                       _mm_or_si128(_mm_slli_epi32(_mm256_extractf128_si256(i1, 1), 8),
+                                    _mm_slli_epi32(_mm256_extractf128_si256(i2, 1), 16)));
+}
+#endif
 
+// In place straight -> premultiplied alpha (every color channel times alpha/255, rounded)
+static void image_premultiply_alpha(u32 width, u32 height, u32 *memory)
+{
+    u64 count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    __m256 inv_255 = _mm256_set1_ps(1.f/255.f);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i *address = (__m128i*)&memory[i];
+        __m128i lo = _mm_loadu_si128(address);
+        __m128i hi = _mm_loadu_si128(address + 1);
+        __m256 alpha = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_srli_epi32(lo, 24), _mm_srli_epi32(hi, 24)));
+        scale_color_channels_8(&lo, &hi, _mm256_mul_ps(alpha, inv_255));
+        _mm_storeu_si128(address, lo);
+        _mm_storeu_si128(address + 1, hi);
+    }
+#endif
+    
+    for (; i < count; i += 1)
+    {
+        memory[i] = scale_color_channels(memory[i], (f32)(memory[i] >> 24)*(1.f/255.f));
+    }
+}
 
-struct App_State
+// In place premultiplied -> straight alpha; pixels with alpha 0 come out black
+static void image_unpremultiply_alpha(u32 width, u32 height, u32 *memory)
 {
-    HWND window;
-    Gdi_Buffer buffer;
-    float saturation;
+    u64 count = (u64)width*height;
+    u64 i = 0;
     
-    char benchmark_text[512];
-};
-static App_State app_state;
+#if Use_Avx
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 value255 = _mm256_set1_ps(255.f);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i *address = (__m128i*)&memory[i];
+        __m128i lo = _mm_loadu_si128(address);
+        __m128i hi = _mm_loadu_si128(address + 1);
+        __m256 alpha = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_srli_epi32(lo, 24), _mm_srli_epi32(hi, 24)));
+        __m256 scale = _mm256_and_ps(_mm256_div_ps(value255, _mm256_max_ps(alpha, value1)),
+                                     _mm256_cmp_ps(alpha, value0, _CMP_GT_OQ));
+        scale_color_channels_8(&lo, &hi, scale);
+        _mm_storeu_si128(address, lo);
+        _mm_storeu_si128(address + 1, hi);
+    }
+#endif
+    
+    for (; i < count; i += 1)
+    {
+        u32 alpha = memory[i] >> 24;
+        memory[i] = scale_color_channels(memory[i], alpha ? 255.f/(f32)alpha : 0.f);
+    }
+}
+
+// Linear light version of convert_image_saturate, below the linear light tables it uses
+template <b32 Swap, b32 Flip>
+static void convert_image_saturate_linear(u32 width, u32 height, u32 *memory, float saturation);
+
+// stats (may be null) are gathered by convert_image_saturate only: with stats, saturation 0 and 1 go through
+// it as well instead of the gray and shuffle kernels, and Convert_Linear ignores them.
+// Convert_Premultiplied only matters to the saturation kernels - gray and shuffle give the same either way.
+static void convert_image_ops(u32 width, u32 height, u32 *memory, u32 ops, float saturation, Image_Stats *stats)
+{
+    u32 swap_flip = ops & (Convert_Swap | Convert_Flip);
+    b32 premultiplied = (ops & Convert_Premultiplied) != 0;
+    
+    if ((ops & Convert_Saturate) && (ops & Convert_Linear) && saturation != 1.f)
+    {
+        // the linear light tables need straight alpha, so this one costs two more passes
+        if (premultiplied)
+        {
+            image_unpremultiply_alpha(width, height, memory);
+        }
+        
+        switch (swap_flip)
+        {
+            case 0:                           convert_image_saturate_linear<false, false>(width, height, memory, saturation); break;
+            case Convert_Swap:                convert_image_saturate_linear<true, false>(width, height, memory, saturation); break;
+            case Convert_Flip:                convert_image_saturate_linear<false, true>(width, height, memory, saturation); break;
+            case Convert_Swap | Convert_Flip: convert_image_saturate_linear<true, true>(width, height, memory, saturation); break;
+        }
+        
+        if (premultiplied)
+        {
+            image_premultiply_alpha(width, height, memory);
+        }
+    }
+    else if ((ops & Convert_Saturate) && !(ops & Convert_Vibrance) && saturation == 0.f && !stats)
+    {
+        // all three channels would be the same, so only the flip matters
+        if (ops & Convert_Flip) convert_image_gray<true>(width, height, memory);
+        else                    convert_image_gray<false>(width, height, memory);
+    }
+    else if ((ops & Convert_Saturate) && (saturation != 1.f || stats))
+    {
+        switch (ops & (Convert_Swap | Convert_Flip | Convert_Vibrance))
+        {
+            case 0:                           convert_image_saturate<false, false, false>(width, height, memory, saturation, premultiplied, stats); break;
+            case Convert_Swap:                convert_image_saturate<true, false, false>(width, height, memory, saturation, premultiplied, stats); break;
+            case Convert_Flip:                convert_image_saturate<false, true, false>(width, height, memory, saturation, premultiplied, stats); break;
+            case Convert_Swap | Convert_Flip: convert_image_saturate<true, true, false>(width, height, memory, saturation, premultiplied, stats); break;
+            
+            case Convert_Vibrance:                               convert_image_saturate<false, false, true>(width, height, memory, saturation, premultiplied, stats); break;
+            case Convert_Vibrance | Convert_Swap:                convert_image_saturate<true, false, true>(width, height, memory, saturation, premultiplied, stats); break;
+            case Convert_Vibrance | Convert_Flip:                convert_image_saturate<false, true, true>(width, height, memory, saturation, premultiplied, stats); break;
+            case Convert_Vibrance | Convert_Swap | Convert_Flip: convert_image_saturate<true, true, true>(width, height, memory, saturation, premultiplied, stats); break;
+        }
+    }
+    else
+    {
+        switch (swap_flip)
+        {
+            case 0: break; // nothing to do
+            case Convert_Swap:                convert_image_shuffle<true, false>(width, height, memory); break;
+            case Convert_Flip:                convert_image_shuffle<false, true>(width, height, memory); break;
+            case Convert_Swap | Convert_Flip: convert_image_shuffle<true, true>(width, height, memory); break;
+        }
+    }
+}
 
+static void convert_image(u32 width, u32 height, u32 *memory, float saturation)
+{
+    convert_image_ops(width, height, memory, Convert_All, saturation, nullptr);
+}
 
+// convert_image that also adds the output pixels to stats, at no extra memory traffic
+static void convert_image_stats(u32 width, u32 height, u32 *memory, float saturation, Image_Stats *stats)
+{
+    convert_image_ops(width, height, memory, Convert_All, saturation, stats);
+}
 
+// convert_image with vibrance instead of saturation - 1 is no change, more boosts the dull colors
+static void convert_image_vibrance(u32 width, u32 height, u32 *memory, float vibrance)
+{
+    convert_image_ops(width, height, memory, Convert_All | Convert_Vibrance, vibrance, nullptr);
+}
 
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_STATIC
-#define STBI_ONLY_PNG
-#define STBI_ASSERT(x) assert(x)
+// convert_image with the saturation done in linear light (Saturation_Luminance_Linear of image_saturate)
+static void convert_image_linear(u32 width, u32 height, u32 *memory, float saturation)
+{
+    convert_image_ops(width, height, memory, Convert_All | Convert_Linear, saturation, nullptr);
+}
 
-// Add padding at the end of the buffer for images with width non-divisible by 4
-// so we don't touch memory beyond the end of the buffer with SSE instructions
-#define align_bin_to(Value, AlignToPow2Number) ((Value + (AlignToPow2Number-1)) & ~(AlignToPow2Number-1))
-#define STBI_MALLOC(sz)           malloc(align_bin_to(sz, 16))
-#define STBI_REALLOC(p,newsz)     realloc(p, align_bin_to(newsz, 16))
-#define STBI_FREE(p)              free(p)
-#include "stb_image.h"
 
 
 
 
+////////////////////////////////
+// Automatic saturation: a sparse pass over every row_step-th row collects the chroma (max - min channel)
+// of the pixels and, for each pixel, the saturation at which convert_image would start clamping one of
+// its channels. That is (255 - luminance)/(max - luminance) or luminance/(luminance - min), because
+// convert_image scales the distances from the luminance. Unclamped output chroma is chroma*saturation,
+// so the saturation for a target mean chroma is target/mean; the clip limits go into a histogram and the
+// clip budget is a percentile of it. The smaller of the two wins.
+#define Auto_Saturation_Bins_Per_Unit 64
+#define Auto_Saturation_Bin_Count (4*Auto_Saturation_Bins_Per_Unit + 1) // saturation 0 - 4, last bin is "never clips"
 
+struct Auto_Saturation
+{
+    f32 target_chroma; // mean chroma of the output (0-255 units), 0 to only use the clip budget
+    f32 clip_budget; // fraction of the pixels that may get a channel clamped
+    f32 max_saturation; // at most 4
+    u32 row_step;
+};
 
-static void image_swap_bytes_between_rgba_and_bgra(u32 width, u32 height, u32 *memory)
+static Auto_Saturation auto_saturation_defaults()
 {
-    for (u64 y = 0; y < height; y += 1)
+    Auto_Saturation result = {};
+    result.target_chroma = 64.f;
+    result.clip_budget = 0.01f;
+    result.max_saturation = 2.f;
+    result.row_step = 8;
+    return result;
+}
+
+struct Auto_Saturation_Sample
+{
+    u32 clip_bins[Auto_Saturation_Bin_Count]; // pixels by the saturation where they start to clip
+    f64 chroma_sum;
+    u64 pixel_count;
+};
+
+__forceinline static void auto_saturation_add_pixel(Auto_Saturation_Sample *sample, u32 value)
+{
+    f32 r = (f32)((value >> 16) & 0xFF);
+    f32 g = (f32)((value >> 8)  & 0xFF);
+    f32 b = (f32)(value         & 0xFF);
+    f32 luminance = (r * 0.2126f +
+                     g * 0.7152f +
+                     b * 0.0722f);
+    f32 high = pick_bigger(pick_bigger(r, g), b);
+    f32 low = pick_smaller(pick_smaller(r, g), b);
+    
+    f32 limit = (f32)Auto_Saturation_Bin_Count;
+    if (high > luminance)
+    {
+        limit = pick_smaller(limit, (255.f - luminance)/(high - luminance));
+    }
+    if (low < luminance)
+    {
+        limit = pick_smaller(limit, luminance/(luminance - low));
+    }
+    u32 bin = (u32)pick_smaller(limit*Auto_Saturation_Bins_Per_Unit, (f32)(Auto_Saturation_Bin_Count - 1));
+    
+    sample->clip_bins[bin] += 1;
+    sample->chroma_sum += high - low;
+    sample->pixel_count += 1;
+}
+
+static void auto_saturation_sample(u32 width, u32 height, u32 *memory, u32 row_step, Auto_Saturation_Sample *sample)
+{
+    memset(sample, 0, sizeof(*sample));
+    row_step = pick_bigger(row_step, 1u);
+    
+#if Use_Avx
+    __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value255 = _mm256_set1_ps(255.f);
+    __m256 no_limit = _mm256_set1_ps((f32)Auto_Saturation_Bin_Count);
+    __m256 bins_per_unit = _mm256_set1_ps((f32)Auto_Saturation_Bins_Per_Unit);
+    __m256 last_bin = _mm256_set1_ps((f32)(Auto_Saturation_Bin_Count - 1));
+#endif
+    
+    for (u64 y = row_step / 2; y < height; y += row_step)
     {
         u32 *row = memory + y*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        // chroma is a whole number, exact in f32 for any row
+        __m256 chroma_sum = value0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i lo = _mm_loadu_si128((__m128i*)&row[x]);
+            __m128i hi = _mm_loadu_si128((__m128i*)&row[x + 4]);
+            __m256 r = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 16), imask_FF),
+                                                            _mm_and_si128(_mm_srli_epi32(hi, 16), imask_FF)));
+            __m256 g = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 8), imask_FF),
+                                                            _mm_and_si128(_mm_srli_epi32(hi, 8), imask_FF)));
+            __m256 b = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(lo, imask_FF),
+                                                            _mm_and_si128(hi, imask_FF)));
             
-        for (u64 x = 0; x < width; x += 1)
+            __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(0.2126f)), _mm256_mul_ps(g, _mm256_set1_ps(0.7152f)));
+            luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, _mm256_set1_ps(0.0722f)));
+            __m256 high = _mm256_max_ps(_mm256_max_ps(r, g), b);
+            __m256 low = _mm256_min_ps(_mm256_min_ps(r, g), b);
+            chroma_sum = _mm256_add_ps(chroma_sum, _mm256_sub_ps(high, low));
+            
+            // the divisions by 0 (gray pixels) are blended away
+            __m256 above = _mm256_sub_ps(high, luminance);
+            __m256 below = _mm256_sub_ps(luminance, low);
+            __m256 limit_high = _mm256_blendv_ps(no_limit, _mm256_div_ps(_mm256_sub_ps(value255, luminance), above),
+                                                 _mm256_cmp_ps(above, value0, _CMP_GT_OQ));
+            __m256 limit_low = _mm256_blendv_ps(no_limit, _mm256_div_ps(luminance, below),
+                                                _mm256_cmp_ps(below, value0, _CMP_GT_OQ));
+            __m256 limit = _mm256_min_ps(_mm256_min_ps(limit_high, limit_low), no_limit);
+            __m256i bin = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(limit, bins_per_unit), last_bin));
+            
+            __m128i bin_low = _mm256_extractf128_si256(bin, 0);
+            __m128i bin_high = _mm256_extractf128_si256(bin, 1);
+            sample->clip_bins[_mm_cvtsi128_si32(bin_low)] += 1;
+            sample->clip_bins[_mm_extract_epi32(bin_low, 1)] += 1;
+            sample->clip_bins[_mm_extract_epi32(bin_low, 2)] += 1;
+            sample->clip_bins[_mm_extract_epi32(bin_low, 3)] += 1;
+            sample->clip_bins[_mm_cvtsi128_si32(bin_high)] += 1;
+            sample->clip_bins[_mm_extract_epi32(bin_high, 1)] += 1;
+            sample->clip_bins[_mm_extract_epi32(bin_high, 2)] += 1;
+            sample->clip_bins[_mm_extract_epi32(bin_high, 3)] += 1;
+        }
+        
+        f32 sums[8];
+        _mm256_storeu_ps(sums, chroma_sum);
+        for (u32 lane = 0; lane < 8; lane += 1)
         {
-            u32 value = row[x];
-            row[x] = (((value & 0xFF'00'FF'00)      ) |
-                      ((value & 0x00'00'00'FF) << 16) |
-                      ((value & 0x00'FF'00'00) >> 16));
+            sample->chroma_sum += sums[lane];
+        }
+        sample->pixel_count += x;
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            auto_saturation_add_pixel(sample, row[x]);
         }
     }
 }
 
-static void image_flip_vertically(u32 width, u32 height, u32 *memory)
+// Saturation for convert_image from the 8-bit pixels (gdi format)
+static f32 image_auto_saturation(u32 width, u32 height, u32 *memory, Auto_Saturation *settings)
 {
-    u32 half_height = height / 2;
+    Auto_Saturation_Sample sample;
+    auto_saturation_sample(width, height, memory, settings->row_step, &sample);
     
-    for (u64 y = 0; y < half_height; y += 1)
+    f32 result = clamp(0.f, settings->max_saturation, 4.f);
+    if (sample.pixel_count)
     {
-        u32 *row = memory + y*width;
-        u32 *opposite_row = memory + (height - y - 1)*width;
+        f64 mean_chroma = sample.chroma_sum / (f64)sample.pixel_count;
+        if (settings->target_chroma > 0.f && mean_chroma > 0.5)
+        {
+            result = pick_smaller(result, (f32)(settings->target_chroma / mean_chroma));
+        }
         
-        for (u64 x = 0; x < width; x += 1)
+        // pixels in bin k start to clip somewhere in [k, k + 1)/Bins_Per_Unit, so at k/Bins_Per_Unit
+        // only the pixels of the bins below k are clipped
+        u64 budget = (u64)(settings->clip_budget*(f64)sample.pixel_count);
+        u64 clipped = 0;
+        for (u32 bin = 0; bin < Auto_Saturation_Bin_Count - 1; bin += 1)
         {
-            u32 temp = row[x];
-            row[x] = opposite_row[x];
-            opposite_row[x] = temp;
+            clipped += sample.clip_bins[bin];
+            if (clipped > budget)
+            {
+                result = pick_smaller(result, (f32)bin/(f32)Auto_Saturation_Bins_Per_Unit);
+                break;
+            }
         }
     }
+    return result;
 }
 
 
 
 
 
-static f32 color_linear_to_srgb(f32 l)
+////////////////////////////////
+// Color matrix: out.rgb = m * (r, g, b, 1) in 0-255 units, with r, g and b named like in convert_pixel
+// (r is bits 16-23). Saturation, hue rotation, brightness, contrast, white balance and channel swaps
+// are all matrices like that, so a stack of adjustments is multiplied into one matrix up front
+// and applied in a single pass that costs about the same as convert_image.
+struct Color_Matrix
 {
-    f32 s;
-    if (l > 0.0031308f)
+    f32 m[3][4];
+};
+
+static Color_Matrix color_matrix_identity()
+{
+    Color_Matrix result = {{
+        {1.f, 0.f, 0.f, 0.f},
+        {0.f, 1.f, 0.f, 0.f},
+        {0.f, 0.f, 1.f, 0.f},
+    }};
+    return result;
+}
+
+// b is applied first, then a
+static Color_Matrix color_matrix_multiply(Color_Matrix *a, Color_Matrix *b)
+{
+    Color_Matrix result = {};
+    for (u32 row = 0; row < 3; row += 1)
     {
-        s = 1.055f*powf(l, 1.f/2.4f) - 0.055f;
+        for (u32 column = 0; column < 4; column += 1)
+        {
+            f32 sum = (column == 3 ? a->m[row][3] : 0.f);
+            for (u32 i = 0; i < 3; i += 1)
+            {
+                sum += a->m[row][i]*b->m[i][column];
+            }
+            result.m[row][column] = sum;
+        }
     }
-    else
+    return result;
+}
+
+static v3 color_matrix_transform(Color_Matrix *matrix, v3 value)
+{
+    v3 result;
+    for (u32 row = 0; row < 3; row += 1)
     {
-        s = l*12.92f;
+        f32 *m = matrix->m[row];
+        result.e[row] = value.x*m[0] + value.y*m[1] + value.z*m[2] + m[3];
     }
-    return s;
+    return result;
 }
 
-static f32 color_srgb_to_linear(f32 s)
+// Same luminance lerp as convert_pixel
+static Color_Matrix color_matrix_saturation(f32 saturation)
 {
-    f32 l;
-    if (s > 0.04045f)
+    f32 lum[3] = {0.2126f, 0.7152f, 0.0722f};
+    Color_Matrix result = {};
+    for (u32 row = 0; row < 3; row += 1)
     {
-        l = powf(((s+0.055f) / 1.055f), 2.4f);
+        for (u32 column = 0; column < 3; column += 1)
+        {
+            result.m[row][column] = (1.f - saturation)*lum[column] + (row == column ? saturation : 0.f);
+        }
     }
-    else
+    return result;
+}
+
+// Rotation around the gray axis - the matrix of the SVG/CSS hue-rotate filter
+static Color_Matrix color_matrix_hue(f32 degrees)
+{
+    f32 angle = degrees*(3.14159265f/180.f);
+    f32 c = cosf(angle);
+    f32 s = sinf(angle);
+    Color_Matrix result = {{
+        {0.213f + c*0.787f - s*0.213f, 0.715f - c*0.715f - s*0.715f, 0.072f - c*0.072f + s*0.928f, 0.f},
+        {0.213f - c*0.213f + s*0.143f, 0.715f + c*0.285f + s*0.140f, 0.072f - c*0.072f - s*0.283f, 0.f},
+        {0.213f - c*0.213f - s*0.787f, 0.715f - c*0.715f + s*0.715f, 0.072f + c*0.928f + s*0.072f, 0.f},
+    }};
+    return result;
+}
+
+// brightness is added to every channel, -1 to 1
+static Color_Matrix color_matrix_brightness(f32 brightness)
+{
+    Color_Matrix result = color_matrix_identity();
+    for (u32 row = 0; row < 3; row += 1)
     {
-        l = s / 12.92f;
+        result.m[row][3] = brightness*255.f;
     }
-    return l;
+    return result;
 }
 
+// scales the distance from mid gray; 1 is no change
+static Color_Matrix color_matrix_contrast(f32 contrast)
+{
+    Color_Matrix result = {};
+    for (u32 row = 0; row < 3; row += 1)
+    {
+        result.m[row][row] = contrast;
+        result.m[row][3] = 127.5f*(1.f - contrast);
+    }
+    return result;
+}
 
-enum Saturation_Type
+// per channel gains
+static Color_Matrix color_matrix_white_balance(f32 r, f32 g, f32 b)
 {
-    Saturation_Hsv,
-    Saturation_Hsl,
-    Saturation_Luminance_Srgb,
-    Saturation_Luminance_Linear,
-};
+    Color_Matrix result = {{
+        {r, 0.f, 0.f, 0.f},
+        {0.f, g, 0.f, 0.f},
+        {0.f, 0.f, b, 0.f},
+    }};
+    return result;
+}
 
-static void image_saturate(u32 width, u32 height, u32 *memory,
-                           f32 saturation, Saturation_Type saturation_type)
+// the R/B swap of convert_image
+static Color_Matrix color_matrix_swap_rb()
 {
-    for (u64 y = 0; y < height; y += 1)
+    Color_Matrix result = {{
+        {0.f, 0.f, 1.f, 0.f},
+        {0.f, 1.f, 0.f, 0.f},
+        {1.f, 0.f, 0.f, 0.f},
+    }};
+    return result;
+}
+
+__forceinline static u32 color_matrix_pixel(u32 value, Color_Matrix *matrix)
+{
+    f32 r = (f32)((value >> 16) & 0xFF);
+    f32 g = (f32)((value >> 8)  & 0xFF);
+    f32 b = (f32)(value         & 0xFF);
+    
+    u32 out[3];
+    for (u32 row = 0; row < 3; row += 1)
+    {
+        f32 *m = matrix->m[row];
+        f32 channel = r*m[0] + g*m[1] + b*m[2] + m[3];
+        out[row] = (u32)clamp(0.f, channel, 255.f);
+    }
+    
+    u32 result = ((value & 0xFF00'0000) |
+                  (out[0] << 16) |
+                  (out[1] << 8) |
+                  out[2]);
+    return result;
+}
+
+// In place; alpha is kept. Rows are processed in top/bottom pairs, Flip decides where they are stored.
+template <b32 Flip>
+static void color_matrix_apply_kernel(u32 width, u32 height, u32 *memory, Color_Matrix *matrix)
+{
+    u32 half_height = height / 2;
+    
+#if Use_Avx
+    __m256 m[3][4];
+    for (u32 row = 0; row < 3; row += 1)
+    {
+        for (u32 column = 0; column < 4; column += 1)
+        {
+            m[row][column] = _mm256_set1_ps(matrix->m[row][column]);
+        }
+    }
+    __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m128i imask_alpha = _mm_set1_epi32(0xFF00'0000);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value255 = _mm256_set1_ps(255.f);
+#endif
+    
+    for (u64 y = 0; y < half_height; y += 1)
     {
         u32 *row = memory + y*width;
+        u32 *opposite_row = memory + (height - y - 1)*width;
+        u64 x = 0;
         
-        for (u64 x = 0; x < width; x += 1)
+#if Use_Avx
+        for (; x + 4 <= width; x += 4)
         {
-            u32 value = row[x];
+            __m128i *top_address = (__m128i*)&row[x];
+            __m128i *bot_address = (__m128i*)&opposite_row[x];
+            __m128i top_input = _mm_loadu_si128(top_address);
+            __m128i bot_input = _mm_loadu_si128(bot_address);
             
-            // this is assuming that our image is in RGBA (R in bottom bits) format now
-            v3 source = {
-                (f32)(value         & 0xFF) / 255.f,
-                (f32)((value >> 8)  & 0xFF) / 255.f,
-                (f32)((value >> 16) & 0xFF) / 255.f,
+            // {top0, top1, top2, top3, bot0, bot1, bot2, bot3} per channel
+            __m256 in[3] = {
+                _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(top_input, 16), imask_FF),
+                                                     _mm_and_si128(_mm_srli_epi32(bot_input, 16), imask_FF))),
+                _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(top_input, 8), imask_FF),
+                                                     _mm_and_si128(_mm_srli_epi32(bot_input, 8), imask_FF))),
+                _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(top_input, imask_FF),
+                                                     _mm_and_si128(bot_input, imask_FF))),
             };
             
-            v3 out = {};
-            
-            switch (saturation_type)
+            __m256i out[3];
+            for (u32 channel = 0; channel < 3; channel += 1)
             {
-                case Saturation_Hsv:
-                {
-                    Color_Hsv hsv = hsv_from_rgb(source);
-                    hsv.s *= saturation;
-                    out = rgb_from_hsv(hsv);
-                } break;
-                
-                case Saturation_Hsl:
-                {
-                    Color_Hsl hsl = hsl_from_rgb(source);
-                    hsl.s *= saturation;
-                    out = rgb_from_hsl(hsl);
-                } break;
-                
-                case Saturation_Luminance_Srgb:
-                {
-                    f32 luminance = (source.r * 0.2126f +
-                                     source.g * 0.7152f +
-                                     source.b * 0.0722f);
-                    v3 gray = {luminance, luminance, luminance};
-                    v3 diff = source - gray;
-                    diff *= saturation;
-                    
-                    out = (gray + diff);
-                } break;
-                
-                case Saturation_Luminance_Linear:
-                {
-                    source.r = color_srgb_to_linear(source.r);
-                    source.g = color_srgb_to_linear(source.g);
-                    source.b = color_srgb_to_linear(source.b);
-                    
-                    f32 luminance = (source.r * 0.2126f +
-                                     source.g * 0.7152f +
-                                     source.b * 0.0722f);
-                    v3 gray = {luminance, luminance, luminance};
-                    v3 diff = source - gray;
-                    diff *= saturation;
-                    
-                    out = (gray + diff);
-                    out.r = color_linear_to_srgb(out.r);
-                    out.g = color_linear_to_srgb(out.g);
-                    out.b = color_linear_to_srgb(out.b);
-                } break;
-            };
+                __m256 sum = _mm256_add_ps(_mm256_mul_ps(in[0], m[channel][0]), m[channel][3]);
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(in[1], m[channel][1]));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(in[2], m[channel][2]));
+                sum = _mm256_max_ps(_mm256_min_ps(sum, value255), value0);
+                out[channel] = _mm256_cvttps_epi32(sum);
+            }
             
+            __m128i top_output = _mm_or_si128(_mm_and_si128(top_input, imask_alpha),
+                                              _mm_slli_epi32(_mm256_extractf128_si256(out[0], 0), 16));
+            __m128i bot_output = _mm_or_si128(_mm_and_si128(bot_input, imask_alpha),
+                                              _mm_slli_epi32(_mm256_extractf128_si256(out[0], 1), 16));
+            top_output = _mm_or_si128(top_output, _mm_slli_epi32(_mm256_extractf128_si256(out[1], 0), 8));
+            bot_output = _mm_or_si128(bot_output, _mm_slli_epi32(_mm256_extractf128_si256(out[1], 1), 8));
+            top_output = _mm_or_si128(top_output, _mm256_extractf128_si256(out[2], 0));
+            bot_output = _mm_or_si128(bot_output, _mm256_extractf128_si256(out[2], 1));
             
-            out = clamp01(out);
-            row[x] = ((value & 0xFF00'0000) |
-                      (u32)(out.z * 255.f) << 16 |
-                      (u32)(out.y * 255.f) << 8 |
-                      (u32)(out.x * 255.f));
+            _mm_storeu_si128(Flip ? bot_address : top_address, top_output);
+            _mm_storeu_si128(Flip ? top_address : bot_address, bot_output);
         }
-    }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u32 row_value = color_matrix_pixel(row[x], matrix);
+            u32 opposite_value = color_matrix_pixel(opposite_row[x], matrix);
+            (Flip ? opposite_row : row)[x] = row_value;
+            (Flip ? row : opposite_row)[x] = opposite_value;
+        }
+    }
+    
+    // middle row for odd heights
+    if (height & 1)
+    {
+        u32 *row = memory + half_height*width;
+        for (u64 x = 0; x < width; x += 1)
+        {
+            row[x] = color_matrix_pixel(row[x], matrix);
+        }
+    }
 }
 
+// convert_image(saturation) is color_matrix_apply(saturation * swap_rb, flip = true), give or take a rounding
+static void color_matrix_apply(u32 width, u32 height, u32 *memory, Color_Matrix *matrix, b32 flip)
+{
+    if (flip) color_matrix_apply_kernel<true>(width, height, memory, matrix);
+    else      color_matrix_apply_kernel<false>(width, height, memory, matrix);
+}
 
 
 
 
 
-static s32 win32_throw_message(char *message)
+////////////////////////////////
+// 3D LUTs (.cube files from grading tools) with tetrahedral interpolation.
+// Entries are stored as 4 floats in the byte order of the output pixel ({b, g, r, 0} in 0-255 units),
+// so one 16 byte load fetches a whole lattice point and the interpolated result packs straight to a pixel.
+// AVX has no gathers, so the lattice coordinates of 4 pixels are computed in SIMD and the 4 corners of
+// each pixel's tetrahedron are blended with SSE, one pixel at a time.
+// The R/B swap is baked into the entries (lut_3d_bake_matrix with color_matrix_swap_rb) and the flip is
+// fused into the pass, so a full grade + convert_image swap/flip is one pass over the pixels.
+#define Lut_3d_Max_Size 256
+
+struct Lut_3d
 {
-    MSGBOXPARAMSA params = {};
-    params.cbSize = sizeof(params);
-    params.lpszText = message;
-    params.dwStyle = MB_ICONERROR | MB_TASKMODAL;
-    params.dwStyle |= MB_OK;
+    u32 size; // lattice points per axis - 17, 33 and 65 are the usual ones
+    f32 *entries; // size^3 * 4 floats, r index changes fastest like in the file
+    f32 domain_min[3];
+    f32 domain_max[3];
+};
+
+static void lut_3d_free(Lut_3d *lut)
+{
+    if (lut->entries)
+    {
+        _aligned_free(lut->entries);
+    }
+    *lut = {};
+}
+
+// Only LUT_3D_SIZE, DOMAIN_MIN, DOMAIN_MAX and LUT_3D_INPUT_RANGE are interpreted; TITLE and other keywords are skipped.
+static b32 lut_3d_load(char *path, Lut_3d *out)
+{
+    *out = {};
+    out->domain_max[0] = out->domain_max[1] = out->domain_max[2] = 1.f;
     
-    s32 message_res = MessageBoxIndirectA(&params);
-    return message_res;
+    Mapped_File file = map_file_read_only(path);
+    if (!file.memory)
+    {
+        return false;
+    }
+    
+    b32 success = false;
+    u64 entry_count = 0;
+    u64 read_count = 0;
+    char line[256];
+    
+    for (u64 at = 0; at < file.size;)
+    {
+        // the mapping is not null terminated, so every line is copied out
+        u32 length = 0;
+        while (at < file.size && file.memory[at] != '\n')
+        {
+            if (length + 1 < sizeof(line))
+            {
+                line[length++] = (char)file.memory[at];
+            }
+            at += 1;
+        }
+        at += 1;
+        line[length] = 0;
+        
+        // indented and whitespace-only lines are fine
+        char *text = line;
+        while (*text == ' ' || *text == '\t' || *text == '\r')
+        {
+            text += 1;
+        }
+        
+        u32 size = 0;
+        f32 values[3];
+        if (text[0] == '#' || text[0] == 0)
+        {
+            continue;
+        }
+        else if (sscanf(text, "LUT_3D_SIZE %u", &size) == 1)
+        {
+            if (out->entries || size < 2 || size > Lut_3d_Max_Size)
+            {
+                break;
+            }
+            out->size = size;
+            entry_count = (u64)size*size*size;
+            out->entries = (f32 *)_aligned_malloc(entry_count*4*sizeof(f32), 16);
+            if (!out->entries)
+            {
+                break;
+            }
+        }
+        else if (sscanf(text, "DOMAIN_MIN %f %f %f", &values[0], &values[1], &values[2]) == 3)
+        {
+            memcpy(out->domain_min, values, sizeof(values));
+        }
+        else if (sscanf(text, "DOMAIN_MAX %f %f %f", &values[0], &values[1], &values[2]) == 3)
+        {
+            memcpy(out->domain_max, values, sizeof(values));
+        }
+        else if (sscanf(text, "LUT_3D_INPUT_RANGE %f %f", &values[0], &values[1]) == 2)
+        {
+            // the older spelling of the domain, one range for all three channels
+            out->domain_min[0] = out->domain_min[1] = out->domain_min[2] = values[0];
+            out->domain_max[0] = out->domain_max[1] = out->domain_max[2] = values[1];
+        }
+        else if (sscanf(text, "%f %f %f", &values[0], &values[1], &values[2]) == 3)
+        {
+            if (!out->entries || read_count >= entry_count)
+            {
+                break;
+            }
+            f32 *entry = out->entries + read_count*4;
+            entry[0] = values[2]*255.f;
+            entry[1] = values[1]*255.f;
+            entry[2] = values[0]*255.f;
+            entry[3] = 0.f;
+            read_count += 1;
+        }
+        else if (text[0] >= 'A' && text[0] <= 'Z')
+        {
+            // TITLE, LUT_1D_SIZE (1D LUTs are not supported - they fail on the entry count) and friends
+            if (strncmp(text, "LUT_1D_SIZE", 11) == 0 || strncmp(text, "LUT_3D_INPUT_RANGE", 18) == 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    
+    success = (out->entries && read_count == entry_count &&
+               out->domain_max[0] > out->domain_min[0] &&
+               out->domain_max[1] > out->domain_min[1] &&
+               out->domain_max[2] > out->domain_min[2]);
+    unmap_file(&file);
+    
+    if (!success)
+    {
+        lut_3d_free(out);
+    }
+    return success;
+}
+
+// Applies the matrix to the output of the LUT - exact for anything linear, including the R/B swap
+static void lut_3d_bake_matrix(Lut_3d *lut, Color_Matrix *matrix)
+{
+    u64 entry_count = (u64)lut->size*lut->size*lut->size;
+    for (u64 i = 0; i < entry_count; i += 1)
+    {
+        f32 *entry = lut->entries + i*4;
+        f32 r = entry[2];
+        f32 g = entry[1];
+        f32 b = entry[0];
+        for (u32 row = 0; row < 3; row += 1)
+        {
+            f32 *m = matrix->m[row];
+            entry[2 - row] = r*m[0] + g*m[1] + b*m[2] + m[3];
+        }
+    }
+}
+
+// pixel channel (0-255) -> lattice coordinate; clamped to the lattice
+struct Lut_3d_Scale
+{
+    f32 scale[3]; // r, g, b
+    f32 offset[3];
+    f32 max_coordinate;
+};
+
+static Lut_3d_Scale lut_3d_scale(Lut_3d *lut)
+{
+    Lut_3d_Scale result = {};
+    result.max_coordinate = (f32)(lut->size - 1);
+    for (u32 i = 0; i < 3; i += 1)
+    {
+        f32 range = lut->domain_max[i] - lut->domain_min[i];
+        result.scale[i] = result.max_coordinate / (255.f*range);
+        result.offset[i] = -lut->domain_min[i]*result.max_coordinate / range;
+    }
+    return result;
+}
+
+// Corner offsets of the tetrahedron that contains (fr, fg, fb) and the fractions sorted from the largest.
+// out = c0 + f1*(cA - c0) + f2*(cB - cA) + f3*(c1 - cB)
+__forceinline static void lut_3d_tetrahedron(u32 size, f32 fr, f32 fg, f32 fb,
+                                             f32 *f, u32 *offset_a, u32 *offset_b)
+{
+    u32 stride_r = 1;
+    u32 stride_g = size;
+    u32 stride_b = size*size;
+    
+    if (fr >= fg)
+    {
+        if (fg >= fb)      { f[0] = fr; f[1] = fg; f[2] = fb; *offset_a = stride_r; *offset_b = stride_r + stride_g; }
+        else if (fr >= fb) { f[0] = fr; f[1] = fb; f[2] = fg; *offset_a = stride_r; *offset_b = stride_r + stride_b; }
+        else               { f[0] = fb; f[1] = fr; f[2] = fg; *offset_a = stride_b; *offset_b = stride_b + stride_r; }
+    }
+    else
+    {
+        if (fb >= fg)      { f[0] = fb; f[1] = fg; f[2] = fr; *offset_a = stride_b; *offset_b = stride_b + stride_g; }
+        else if (fb >= fr) { f[0] = fg; f[1] = fb; f[2] = fr; *offset_a = stride_g; *offset_b = stride_g + stride_b; }
+        else               { f[0] = fg; f[1] = fr; f[2] = fb; *offset_a = stride_g; *offset_b = stride_g + stride_r; }
+    }
+}
+
+__forceinline static u32 lut_3d_pixel(u32 value, Lut_3d *lut, Lut_3d_Scale *scale)
+{
+    f32 channels[3] = {
+        (f32)((value >> 16) & 0xFF),
+        (f32)((value >> 8)  & 0xFF),
+        (f32)(value         & 0xFF),
+    };
+    
+    u32 base = 0;
+    f32 fraction[3];
+    u32 strides[3] = {1, lut->size, lut->size*lut->size};
+    for (u32 i = 0; i < 3; i += 1)
+    {
+        f32 coordinate = clamp(0.f, channels[i]*scale->scale[i] + scale->offset[i], scale->max_coordinate);
+        u32 index = pick_smaller((u32)coordinate, lut->size - 2);
+        fraction[i] = coordinate - (f32)index;
+        base += index*strides[i];
+    }
+    
+    f32 f[3];
+    u32 offset_a, offset_b;
+    lut_3d_tetrahedron(lut->size, fraction[0], fraction[1], fraction[2], f, &offset_a, &offset_b);
+    
+    f32 *c0 = lut->entries + base*4;
+    f32 *ca = lut->entries + (base + offset_a)*4;
+    f32 *cb = lut->entries + (base + offset_b)*4;
+    f32 *c1 = lut->entries + (base + strides[0] + strides[1] + strides[2])*4;
+    
+    u32 result = (value & 0xFF00'0000);
+    for (u32 i = 0; i < 3; i += 1)
+    {
+        f32 out = c0[i] + f[0]*(ca[i] - c0[i]) + f[1]*(cb[i] - ca[i]) + f[2]*(c1[i] - cb[i]);
+        result |= (u32)(clamp(0.f, out, 255.f) + 0.5f) << (i*8);
+    }
+    return result;
+}
+
+#if Use_Avx
+// 4 pixels through the LUT; alpha is kept
+__forceinline static __m128i lut_3d_pixels_4(__m128i input, Lut_3d *lut, Lut_3d_Scale *scale)
+{
+    __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m128 max_coordinate = _mm_set1_ps(scale->max_coordinate);
+    __m128i max_index = _mm_set1_epi32((s32)lut->size - 2);
+    
+    __m128i channels[3] = {
+        _mm_and_si128(_mm_srli_epi32(input, 16), imask_FF),
+        _mm_and_si128(_mm_srli_epi32(input, 8), imask_FF),
+        _mm_and_si128(input, imask_FF),
+    };
+    
+    __m128i base = _mm_setzero_si128();
+    __m128 fractions[3];
+    __m128i strides[3] = {
+        _mm_set1_epi32(1),
+        _mm_set1_epi32((s32)lut->size),
+        _mm_set1_epi32((s32)(lut->size*lut->size)),
+    };
+    for (u32 i = 0; i < 3; i += 1)
+    {
+        __m128 coordinate = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(channels[i]), _mm_set1_ps(scale->scale[i])),
+                                       _mm_set1_ps(scale->offset[i]));
+        coordinate = _mm_max_ps(_mm_min_ps(coordinate, max_coordinate), _mm_setzero_ps());
+        __m128i index = _mm_min_epi32(_mm_cvttps_epi32(coordinate), max_index);
+        fractions[i] = _mm_sub_ps(coordinate, _mm_cvtepi32_ps(index));
+        base = _mm_add_epi32(base, _mm_mullo_epi32(index, strides[i]));
+    }
+    
+    // Picking the tetrahedron without branches (random colors mispredict every one of them):
+    // A steps along the axis with the largest fraction, B along everything but the smallest one.
+    // Ties go to r, then g - any consistent choice gives the same result.
+    __m128 fr = fractions[0];
+    __m128 fg = fractions[1];
+    __m128 fb = fractions[2];
+    __m128i r_max = _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(fr, fg), _mm_cmpge_ps(fr, fb)));
+    __m128i g_max = _mm_andnot_si128(r_max, _mm_castps_si128(_mm_cmpge_ps(fg, fb)));
+    __m128i b_min = _mm_castps_si128(_mm_and_ps(_mm_cmple_ps(fb, fr), _mm_cmple_ps(fb, fg)));
+    __m128i g_min = _mm_andnot_si128(b_min, _mm_castps_si128(_mm_cmple_ps(fg, fr)));
+    
+    __m128i far_corner = _mm_add_epi32(_mm_add_epi32(strides[0], strides[1]), strides[2]);
+    __m128i offset_a = _mm_blendv_epi8(_mm_blendv_epi8(strides[2], strides[1], g_max), strides[0], r_max);
+    __m128i min_stride = _mm_blendv_epi8(_mm_blendv_epi8(strides[0], strides[1], g_min), strides[2], b_min);
+    __m128i offset_b = _mm_sub_epi32(far_corner, min_stride);
+    
+    __m128 f1 = _mm_max_ps(_mm_max_ps(fr, fg), fb);
+    __m128 f3 = _mm_min_ps(_mm_min_ps(fr, fg), fb);
+    __m128 f2 = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(fr, fg), fb), f1), f3);
+    
+    // entry offsets in floats
+    alignas(16) u32 c0_offsets[4], a_offsets[4], b_offsets[4];
+    alignas(16) f32 w1[4], w2[4], w3[4];
+    _mm_store_si128((__m128i*)c0_offsets, _mm_slli_epi32(base, 2));
+    _mm_store_si128((__m128i*)a_offsets, _mm_slli_epi32(offset_a, 2));
+    _mm_store_si128((__m128i*)b_offsets, _mm_slli_epi32(offset_b, 2));
+    _mm_store_ps(w1, f1);
+    _mm_store_ps(w2, f2);
+    _mm_store_ps(w3, f3);
+    u32 c1_offset = (u32)_mm_cvtsi128_si32(far_corner)*4;
+    
+    __m128i pixels[4];
+    for (u32 lane = 0; lane < 4; lane += 1)
+    {
+        f32 *c0_address = lut->entries + c0_offsets[lane];
+        __m128 c0 = _mm_load_ps(c0_address);
+        __m128 ca = _mm_load_ps(c0_address + a_offsets[lane]);
+        __m128 cb = _mm_load_ps(c0_address + b_offsets[lane]);
+        __m128 c1 = _mm_load_ps(c0_address + c1_offset);
+        
+        __m128 out = _mm_add_ps(c0, _mm_mul_ps(_mm_set1_ps(w1[lane]), _mm_sub_ps(ca, c0)));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(w2[lane]), _mm_sub_ps(cb, ca)));
+        out = _mm_add_ps(out, _mm_mul_ps(_mm_set1_ps(w3[lane]), _mm_sub_ps(c1, cb)));
+        pixels[lane] = _mm_cvtps_epi32(out);
+    }
+    
+    // {b, g, r, 0} x 4 -> 4 pixels; the packs clamp to 0-255
+    __m128i words = _mm_packs_epi32(pixels[0], pixels[1]);
+    __m128i words_high = _mm_packs_epi32(pixels[2], pixels[3]);
+    __m128i result = _mm_packus_epi16(words, words_high);
+    result = _mm_or_si128(result, _mm_and_si128(input, _mm_set1_epi32(0xFF00'0000)));
+    return result;
+}
+#endif
+
+template <b32 Flip>
+static void lut_3d_apply_kernel(u32 width, u32 height, u32 *memory, Lut_3d *lut)
+{
+    u32 half_height = height / 2;
+    Lut_3d_Scale scale = lut_3d_scale(lut);
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u32 *row = memory + y*width;
+        u32 *opposite_row = memory + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i *top_address = (__m128i*)&row[x];
+            __m128i *bot_address = (__m128i*)&opposite_row[x];
+            __m128i top_output = lut_3d_pixels_4(_mm_loadu_si128(top_address), lut, &scale);
+            __m128i bot_output = lut_3d_pixels_4(_mm_loadu_si128(bot_address), lut, &scale);
+            _mm_storeu_si128(Flip ? bot_address : top_address, top_output);
+            _mm_storeu_si128(Flip ? top_address : bot_address, bot_output);
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u32 row_value = lut_3d_pixel(row[x], lut, &scale);
+            u32 opposite_value = lut_3d_pixel(opposite_row[x], lut, &scale);
+            (Flip ? opposite_row : row)[x] = row_value;
+            (Flip ? row : opposite_row)[x] = opposite_value;
+        }
+    }
+    
+    // middle row for odd heights
+    if (height & 1)
+    {
+        u32 *row = memory + half_height*width;
+        for (u64 x = 0; x < width; x += 1)
+        {
+            row[x] = lut_3d_pixel(row[x], lut, &scale);
+        }
+    }
+}
+
+static void lut_3d_apply(u32 width, u32 height, u32 *memory, Lut_3d *lut, b32 flip)
+{
+    if (flip) lut_3d_apply_kernel<true>(width, height, memory, lut);
+    else      lut_3d_apply_kernel<false>(width, height, memory, lut);
 }
 
 
 
 
 
-static void reload_default_image()
+////////////////////////////////
+// 16 bits per channel versions of the kernels above, for 16-bit PNGs.
+// One pixel is u16x4 packed in u64 with the same channel order as the u32 pixels (B is in the lowest 16 bits).
+__forceinline static u64 convert_pixel_16(u64 value, f32 saturation)
+{
+    v3 source = {
+        (f32)((value >> 32) & 0xFFFF),
+        (f32)((value >> 16) & 0xFFFF),
+        (f32)(value         & 0xFFFF),
+    };
+    
+    f32 luminance = (source.r * 0.2126f +
+                     source.g * 0.7152f +
+                     source.b * 0.0722f);
+    v3 gray = {luminance, luminance, luminance};
+    v3 diff = source - gray;
+    diff *= saturation;
+    
+    v3 out = (gray + diff);
+    out.x = clamp(0.f, out.x, 65535.f);
+    out.y = clamp(0.f, out.y, 65535.f);
+    out.z = clamp(0.f, out.z, 65535.f);
+    
+    u64 r = (u64)out.r;
+    u64 g = (u64)out.g;
+    u64 b = (u64)out.b;
+    
+    u64 result = ((value & 0xFFFF'0000'0000'0000) |
+                  (b << 32) |
+                  (g << 16) |
+                  r);
+    return result;
+}
+
+#if Use_Avx
+// 4 pixels (two registers with 2 pixels each) -> 4 lanes per channel
+__forceinline static void deinterleave_pixels_16(__m128i lo, __m128i hi, __m128i *c01, __m128i *c23)
+{
+    __m128i t0 = _mm_unpacklo_epi16(lo, hi); // p0c0 p2c0 p0c1 p2c1 p0c2 p2c2 p0c3 p2c3
+    __m128i t1 = _mm_unpackhi_epi16(lo, hi); // p1c0 p3c0 p1c1 p3c1 p1c2 p3c2 p1c3 p3c3
+    *c01 = _mm_unpacklo_epi16(t0, t1);       // p0c0 p1c0 p2c0 p3c0 p0c1 p1c1 p2c1 p3c1
+    *c23 = _mm_unpackhi_epi16(t0, t1);       // p0c2 p1c2 p2c2 p3c2 p0c3 p1c3 p2c3 p3c3
+}
+
+// inverse of deinterleave_pixels_16
+__forceinline static void interleave_pixels_16(__m128i c01, __m128i c23, __m128i *lo, __m128i *hi)
+{
+    __m128i x01 = _mm_unpacklo_epi16(c01, _mm_srli_si128(c01, 8)); // p0c0 p0c1 p1c0 p1c1 ...
+    __m128i x23 = _mm_unpacklo_epi16(c23, _mm_srli_si128(c23, 8)); // p0c2 p0c3 p1c2 p1c3 ...
+    *lo = _mm_unpacklo_epi32(x01, x23);
+    *hi = _mm_unpackhi_epi32(x01, x23);
+}
+#endif
+
+
+static void convert_image_16(u32 width, u32 height, u64 *memory, float saturation)
 {
-    if (app_state.buffer.memory)
+    u32 half_height = height / 2;
+    u32 simd_width = 0;
+    
+#if Use_Avx
+    // Same algorithm as convert_image - top and bottom rows are processed together
+    // and 4 pixels from each make 8 float lanes. Tails are done by convert_pixel_16.
+    simd_width = width & ~3u;
+    
+    __m256 coef_r = _mm256_set1_ps(0.2126f);
+    __m256 coef_g = _mm256_set1_ps(0.7152f);
+    __m256 coef_b = _mm256_set1_ps(0.0722f);
+    __m256 saturation_wide = _mm256_set1_ps(saturation);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value65535 = _mm256_set1_ps(65535.f);
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u64 *row = memory + y*width;
+        u64 *opposite_row = memory + (height - y - 1)*width;
+        
+        for (u64 x = 0; x < simd_width; x += 4)
+        {
+            // Loading data
+            __m128i *top_address = (__m128i*)&row[x];
+            __m128i *bot_address = (__m128i*)&opposite_row[x];
+            
+            __m128i top_c01, top_c23, bot_c01, bot_c23;
+            deinterleave_pixels_16(_mm_loadu_si128(top_address), _mm_loadu_si128(top_address + 1), &top_c01, &top_c23);
+            deinterleave_pixels_16(_mm_loadu_si128(bot_address), _mm_loadu_si128(bot_address + 1), &bot_c01, &bot_c23);
+            
+            
+            // Unpacking to 8 floats per channel; c0 is blue and c2 is red
+            __m256 b = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_cvtepu16_epi32(top_c01),
+                                                            _mm_cvtepu16_epi32(bot_c01)));
+            __m256 g = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_cvtepu16_epi32(_mm_srli_si128(top_c01, 8)),
+                                                            _mm_cvtepu16_epi32(_mm_srli_si128(bot_c01, 8))));
+            __m256 r = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_cvtepu16_epi32(top_c23),
+                                                            _mm_cvtepu16_epi32(bot_c23)));
+            
+            
+            // Calculate saturation
+            __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+            luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+            
+            __m256 diff_r = _mm256_mul_ps(_mm256_sub_ps(r, luminance), saturation_wide);
+            __m256 diff_g = _mm256_mul_ps(_mm256_sub_ps(g, luminance), saturation_wide);
+            __m256 diff_b = _mm256_mul_ps(_mm256_sub_ps(b, luminance), saturation_wide);
+            
+            r = _mm256_add_ps(luminance, diff_r);
+            g = _mm256_add_ps(luminance, diff_g);
+            b = _mm256_add_ps(luminance, diff_b);
+            
+            r = _mm256_max_ps(_mm256_min_ps(r, value65535), value0);
+            g = _mm256_max_ps(_mm256_min_ps(g, value65535), value0);
+            b = _mm256_max_ps(_mm256_min_ps(b, value65535), value0);
+            
+            
+            // Going back to u16x4; red goes to c0 and blue to c2, alpha stays where it was
+            __m256i ri = _mm256_cvttps_epi32(r);
+            __m256i gi = _mm256_cvttps_epi32(g);
+            __m256i bi = _mm256_cvttps_epi32(b);
+            
+            __m128i top_out_c01 = _mm_packus_epi32(_mm256_extractf128_si256(ri, 0), _mm256_extractf128_si256(gi, 0));
+            __m128i bot_out_c01 = _mm_packus_epi32(_mm256_extractf128_si256(ri, 1), _mm256_extractf128_si256(gi, 1));
+            __m128i top_out_c23 = _mm_packus_epi32(_mm256_extractf128_si256(bi, 0), _mm_cvtepu16_epi32(_mm_srli_si128(top_c23, 8)));
+            __m128i bot_out_c23 = _mm_packus_epi32(_mm256_extractf128_si256(bi, 1), _mm_cvtepu16_epi32(_mm_srli_si128(bot_c23, 8)));
+            
+            __m128i top_lo, top_hi, bot_lo, bot_hi;
+            interleave_pixels_16(top_out_c01, top_out_c23, &top_lo, &top_hi);
+            interleave_pixels_16(bot_out_c01, bot_out_c23, &bot_lo, &bot_hi);
+            
+            
+            // Store the data back + swap top and bottom rows
+            _mm_storeu_si128(bot_address, top_lo);
+            _mm_storeu_si128(bot_address + 1, top_hi);
+            _mm_storeu_si128(top_address, bot_lo);
+            _mm_storeu_si128(top_address + 1, bot_hi);
+        }
+    }
+#endif
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u64 *row = memory + y*width;
+        u64 *opposite_row = memory + (height - y - 1)*width;
+        
+        for (u64 x = simd_width; x < width; x += 1)
+        {
+            u64 row_value = convert_pixel_16(row[x], saturation);
+            u64 opposite_value = convert_pixel_16(opposite_row[x], saturation);
+            
+            opposite_row[x] = row_value;
+            row[x] = opposite_value;
+        }
+    }
+    
+    // middle row for odd heights
+    if (height & 1)
+    {
+        u64 *row = memory + half_height*width;
+        
+        for (u64 x = 0; x < width; x += 1)
+        {
+            row[x] = convert_pixel_16(row[x], saturation);
+        }
+    }
+}
+
+
+static void image_swap_bytes_between_rgba_and_bgra_16(u32 width, u32 height, u64 *memory)
+{
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    // swaps 16-bit lanes 0 and 2 of every pixel
+    __m128i shuffle = _mm_setr_epi8(4,5, 2,3, 0,1, 6,7, 12,13, 10,11, 8,9, 14,15);
+    for (; i + 2 <= pixel_count; i += 2)
+    {
+        __m128i *address = (__m128i*)&memory[i];
+        _mm_storeu_si128(address, _mm_shuffle_epi8(_mm_loadu_si128(address), shuffle));
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        u64 value = memory[i];
+        memory[i] = (((value & 0xFFFF'0000'FFFF'0000)      ) |
+                     ((value & 0x0000'0000'0000'FFFF) << 32) |
+                     ((value & 0x0000'FFFF'0000'0000) >> 32));
+    }
+}
+
+static void image_flip_vertically_16(u32 width, u32 height, u64 *memory)
+{
+    u32 half_height = height / 2;
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u64 *row = memory + y*width;
+        u64 *opposite_row = memory + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 4 <= width; x += 4)
+        {
+            __m256i *top_address = (__m256i*)&row[x];
+            __m256i *bot_address = (__m256i*)&opposite_row[x];
+            __m256i top = _mm256_loadu_si256(top_address);
+            __m256i bot = _mm256_loadu_si256(bot_address);
+            _mm256_storeu_si256(top_address, bot);
+            _mm256_storeu_si256(bot_address, top);
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u64 temp = row[x];
+            row[x] = opposite_row[x];
+            opposite_row[x] = temp;
+        }
+    }
+}
+
+// Keeps the top 8 bits of every channel - same as stb_image.h does when it converts 16-bit images to 8-bit
+static void image_quantize_16_to_8(u32 width, u32 height, u64 *source, u32 *destination)
+{
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    for (; i + 4 <= pixel_count; i += 4)
+    {
+        __m128i lo = _mm_srli_epi16(_mm_loadu_si128((__m128i*)&source[i]), 8);
+        __m128i hi = _mm_srli_epi16(_mm_loadu_si128((__m128i*)&source[i + 2]), 8);
+        _mm_storeu_si128((__m128i*)&destination[i], _mm_packus_epi16(lo, hi));
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        u64 value = source[i];
+        destination[i] = (u32)(((value >> 8)  & 0x0000'00FF) |
+                               ((value >> 16) & 0x0000'FF00) |
+                               ((value >> 24) & 0x00FF'0000) |
+                               ((value >> 32) & 0xFF00'0000));
+    }
+}
+
+
+
+
+
+////////////////////////////////
+// Pixel format conversion between the 8-bit layouts. A layout is a pixel size and the byte offsets
+// of B, G, R and A, so one kernel shape covers every pair: 4 pixels are loaded, put in place with one
+// pshufb whose table is built from the two layouts, and the alpha a source doesn't have is ORed in as 255.
+// The flip only changes which row is written (in place it takes the rows in top/bottom pairs like convert_image).
+// The names are the byte order in memory - gdi pixels are Pixel_Bgra.
+enum Pixel_Format
+{
+    Pixel_Bgra, // gdi
+    Pixel_Rgba, // stb_image.h
+    Pixel_Argb,
+    Pixel_Abgr,
+    Pixel_Bgr,  // 24-bit DIB (see image_stride_24)
+    Pixel_Rgb,
+    
+    // Source only - gray out of color is a luminance, not a byte shuffle (see image_luminance_plane)
+    Pixel_Gray,
+    Pixel_Gray_Alpha,
+    
+    Pixel_Format_Count,
+};
+
+struct Pixel_Layout
+{
+    u32 bytes;      // per pixel
+    s32 offsets[4]; // of B, G, R and A; -1 when there is no alpha (it reads as 255)
+};
+
+static Pixel_Layout pixel_layout(Pixel_Format format)
+{
+    static Pixel_Layout layouts[Pixel_Format_Count] = {
+        {4, {0, 1, 2, 3}},
+        {4, {2, 1, 0, 3}},
+        {4, {3, 2, 1, 0}},
+        {4, {1, 2, 3, 0}},
+        {3, {0, 1, 2, -1}},
+        {3, {2, 1, 0, -1}},
+        {1, {0, 0, 0, -1}},
+        {2, {0, 0, 0, 1}},
+    };
+    return layouts[format];
+}
+
+__forceinline static void pixel_read_channels(u8 *pixel, Pixel_Layout *layout, u8 *channels)
+{
+    for (u32 channel = 0; channel < 4; channel += 1)
+    {
+        s32 offset = layout->offsets[channel];
+        channels[channel] = (u8)(offset >= 0 ? pixel[offset] : 0xFF);
+    }
+}
+
+__forceinline static void pixel_write_channels(u8 *pixel, Pixel_Layout *layout, u8 *channels)
+{
+    for (u32 channel = 0; channel < 4; channel += 1)
+    {
+        s32 offset = layout->offsets[channel];
+        if (offset >= 0)
+        {
+            pixel[offset] = channels[channel];
+        }
+    }
+}
+
+#if Use_Avx
+__forceinline static void store_12_bytes(u8 *destination, __m128i value)
+{
+    _mm_storel_epi64((__m128i*)destination, value);
+    *(u32 *)(destination + 8) = (u32)_mm_cvtsi128_si32(_mm_srli_si128(value, 8));
+}
+
+// pshufb table that turns 4 source pixels into 4 destination pixels, and the bytes to OR in after it
+static void pixel_shuffle_4(Pixel_Layout *source, Pixel_Layout *destination, __m128i *shuffle, __m128i *fill)
+{
+    s8 table[16];
+    u8 fill_bytes[16];
+    for (u32 i = 0; i < 16; i += 1)
+    {
+        table[i] = -1;
+        fill_bytes[i] = 0;
+    }
+    
+    for (u32 pixel = 0; pixel < 4; pixel += 1)
+    {
+        for (u32 channel = 0; channel < 4; channel += 1)
+        {
+            s32 from = source->offsets[channel];
+            s32 to = destination->offsets[channel];
+            if (to >= 0)
+            {
+                u32 index = pixel*destination->bytes + (u32)to;
+                if (from >= 0) table[index] = (s8)(pixel*source->bytes + (u32)from);
+                else           fill_bytes[index] = 0xFF;
+            }
+        }
+    }
+    
+    *shuffle = _mm_loadu_si128((__m128i*)table);
+    *fill = _mm_loadu_si128((__m128i*)fill_bytes);
+}
+
+// Exactly Bytes*4 bytes, so the last pixels of a buffer can be loaded too
+template <u32 Bytes>
+__forceinline static __m128i pixel_load_4(u8 *pixels)
+{
+    __m128i result = _mm_setzero_si128();
+    switch (Bytes)
+    {
+        case 1: result = _mm_cvtsi32_si128(*(s32 *)pixels); break;
+        case 2: result = _mm_loadl_epi64((__m128i*)pixels); break;
+        case 3: result = _mm_insert_epi32(_mm_loadl_epi64((__m128i*)pixels), *(s32 *)(pixels + 8), 2); break;
+        case 4: result = _mm_loadu_si128((__m128i*)pixels); break;
+    }
+    return result;
+}
+
+template <u32 Bytes>
+__forceinline static void pixel_store_4(u8 *pixels, __m128i value)
+{
+    switch (Bytes)
+    {
+        case 3: store_12_bytes(pixels, value); break;
+        case 4: _mm_storeu_si128((__m128i*)pixels, value); break;
+    }
+}
+#endif
+
+template <u32 Source_Bytes, u32 Destination_Bytes>
+static void image_convert_format_kernel(u32 width, u32 height,
+                                        u8 *source, u32 source_stride, Pixel_Layout source_layout,
+                                        u8 *destination, u32 destination_stride, Pixel_Layout destination_layout,
+                                        b32 flip)
+{
+#if Use_Avx
+    __m128i shuffle, fill;
+    pixel_shuffle_4(&source_layout, &destination_layout, &shuffle, &fill);
+#endif
+    
+    if (flip && source == destination)
+    {
+        // In place flip: rows go in top/bottom pairs, both loaded before either is stored.
+        // The middle row of odd heights is paired with itself.
+        for (u64 y = 0; y < (height + 1) / 2; y += 1)
+        {
+            u8 *row = source + y*source_stride;
+            u8 *opposite_row = source + (height - y - 1)*source_stride;
+            u64 x = 0;
+            
+#if Use_Avx
+            for (; x + 4 <= width; x += 4)
+            {
+                __m128i top = pixel_load_4<Source_Bytes>(row + x*Source_Bytes);
+                __m128i bot = pixel_load_4<Source_Bytes>(opposite_row + x*Source_Bytes);
+                pixel_store_4<Destination_Bytes>(opposite_row + x*Destination_Bytes, _mm_or_si128(_mm_shuffle_epi8(top, shuffle), fill));
+                pixel_store_4<Destination_Bytes>(row + x*Destination_Bytes, _mm_or_si128(_mm_shuffle_epi8(bot, shuffle), fill));
+            }
+#endif
+            
+            for (; x < width; x += 1)
+            {
+                u8 top[4], bot[4];
+                pixel_read_channels(row + x*Source_Bytes, &source_layout, top);
+                pixel_read_channels(opposite_row + x*Source_Bytes, &source_layout, bot);
+                pixel_write_channels(opposite_row + x*Destination_Bytes, &destination_layout, top);
+                pixel_write_channels(row + x*Destination_Bytes, &destination_layout, bot);
+            }
+        }
+    }
+    else
+    {
+        for (u64 y = 0; y < height; y += 1)
+        {
+            u8 *source_row = source + y*source_stride;
+            u8 *destination_row = destination + (flip ? height - y - 1 : y)*destination_stride;
+            u64 x = 0;
+            
+#if Use_Avx
+            for (; x + 4 <= width; x += 4)
+            {
+                __m128i pixels = pixel_load_4<Source_Bytes>(source_row + x*Source_Bytes);
+                pixel_store_4<Destination_Bytes>(destination_row + x*Destination_Bytes, _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), fill));
+            }
+#endif
+            
+            for (; x < width; x += 1)
+            {
+                u8 channels[4];
+                pixel_read_channels(source_row + x*Source_Bytes, &source_layout, channels);
+                pixel_write_channels(destination_row + x*Destination_Bytes, &destination_layout, channels);
+            }
+        }
+    }
+}
+
+// Copies width x height pixels from one format to another, turning the image upside down when flip is set
+// (stb_image.h top-down rows <-> gdi bottom-up rows). Strides are in bytes.
+// source and destination can be the same memory when both formats have the same pixel size.
+static void image_convert_format(u32 width, u32 height,
+                                 u8 *source, u32 source_stride, Pixel_Format source_format,
+                                 u8 *destination, u32 destination_stride, Pixel_Format destination_format,
+                                 b32 flip)
+{
+    assert(destination_format < Pixel_Gray);
+    Pixel_Layout from = pixel_layout(source_format);
+    Pixel_Layout to = pixel_layout(destination_format);
+    assert(source != destination || from.bytes == to.bytes);
+    
+    // source and destination pixel sizes as two digits
+    switch (from.bytes*10 + to.bytes)
+    {
+        case 13: image_convert_format_kernel<1, 3>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 14: image_convert_format_kernel<1, 4>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 23: image_convert_format_kernel<2, 3>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 24: image_convert_format_kernel<2, 4>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 33: image_convert_format_kernel<3, 3>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 34: image_convert_format_kernel<3, 4>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 43: image_convert_format_kernel<4, 3>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+        case 44: image_convert_format_kernel<4, 4>(width, height, source, source_stride, from, destination, destination_stride, to, flip); break;
+    }
+}
+
+static void image_convert_format_in_place(u32 width, u32 height, u8 *memory, u32 stride,
+                                          Pixel_Format from, Pixel_Format to, b32 flip)
+{
+    image_convert_format(width, height, memory, stride, from, memory, stride, to, flip);
+}
+
+
+////////////////////////////////
+// Packed 24 bits per pixel versions for opaque images - 25% less memory traffic than the u32 pixels.
+// Same layout as a 24-bit DIB: B G R bytes, bottom-up, rows padded to 4 bytes.
+// The SSE paths move 4 pixels (12 bytes) at a time with 16 byte loads, so they stop where a load
+// would leave the row and the tails are scalar. Stores are 8 + 4 bytes so the next pixel is never touched.
+static u32 image_stride_24(u32 width)
+{
+    u32 result = align_bin_to(width*3, 4u);
+    return result;
+}
+
+#if Use_Avx
+__forceinline static b32 simd_fits_24(u64 x, u32 width, u32 stride)
+{
+    b32 result = (x + 4 <= width && x*3 + 16 <= stride);
+    return result;
+}
+#endif
+
+__forceinline static u32 load_pixel_24(u8 *pixel)
+{
+    u32 result = (0xFF00'0000 | (pixel[2] << 16) | (pixel[1] << 8) | pixel[0]);
+    return result;
+}
+
+__forceinline static void store_pixel_24(u8 *pixel, u32 value)
+{
+    pixel[0] = (u8)value;
+    pixel[1] = (u8)(value >> 8);
+    pixel[2] = (u8)(value >> 16);
+}
+
+static void convert_image_24(u32 width, u32 height, u8 *memory, float saturation)
+{
+    u32 half_height = height / 2;
+    u32 stride = image_stride_24(width);
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u8 *row = memory + y*stride;
+        u8 *opposite_row = memory + (height - y - 1)*stride;
+        u64 x = 0;
+        
+#if Use_Avx
+        // Same algorithm as convert_image; pshufb spreads the 12 bytes of 4 pixels to u32 lanes per channel
+        // and packs them back.
+        __m128i shuffle_b = _mm_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+        __m128i shuffle_g = _mm_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+        __m128i shuffle_r = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+        __m128i shuffle_pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        
+        __m256 coef_r = _mm256_set1_ps(0.2126f);
+        __m256 coef_g = _mm256_set1_ps(0.7152f);
+        __m256 coef_b = _mm256_set1_ps(0.0722f);
+        __m256 saturation_wide = _mm256_set1_ps(saturation);
+        __m256 value0 = _mm256_set1_ps(0.f);
+        __m256 value255 = _mm256_set1_ps(255.f);
+        
+        for (; simd_fits_24(x, width, stride); x += 4)
+        {
+            u8 *top_address = row + x*3;
+            u8 *bot_address = opposite_row + x*3;
+            __m128i top_input = _mm_loadu_si128((__m128i*)top_address);
+            __m128i bot_input = _mm_loadu_si128((__m128i*)bot_address);
+            
+            __m256 r = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_shuffle_epi8(top_input, shuffle_r),
+                                                            _mm_shuffle_epi8(bot_input, shuffle_r)));
+            __m256 g = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_shuffle_epi8(top_input, shuffle_g),
+                                                            _mm_shuffle_epi8(bot_input, shuffle_g)));
+            __m256 b = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_shuffle_epi8(top_input, shuffle_b),
+                                                            _mm_shuffle_epi8(bot_input, shuffle_b)));
+            
+            
+            // Calculate saturation
+            __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+            luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+            
+            __m256 diff_r = _mm256_mul_ps(_mm256_sub_ps(r, luminance), saturation_wide);
+            __m256 diff_g = _mm256_mul_ps(_mm256_sub_ps(g, luminance), saturation_wide);
+            __m256 diff_b = _mm256_mul_ps(_mm256_sub_ps(b, luminance), saturation_wide);
+            
+            r = _mm256_add_ps(luminance, diff_r);
+            g = _mm256_add_ps(luminance, diff_g);
+            b = _mm256_add_ps(luminance, diff_b);
+            
+            r = _mm256_max_ps(_mm256_min_ps(r, value255), value0);
+            g = _mm256_max_ps(_mm256_min_ps(g, value255), value0);
+            b = _mm256_max_ps(_mm256_min_ps(b, value255), value0);
+            
+            
+            // Back to bytes with red and blue swapped (like convert_image)
+            __m256i ri = _mm256_cvttps_epi32(r);
+            __m256i gi = _mm256_cvttps_epi32(g);
+            __m256i bi = _mm256_cvttps_epi32(b);
+            
+            __m128i top_output = _mm_or_si128(_mm_or_si128(_mm256_extractf128_si256(ri, 0),
+                                                           _mm_slli_epi32(_mm256_extractf128_si256(gi, 0), 8)),
+                                              _mm_slli_epi32(_mm256_extractf128_si256(bi, 0), 16));
+            __m128i bot_output = _mm_or_si128(_mm_or_si128(_mm256_extractf128_si256(ri, 1),
+                                                           _mm_slli_epi32(_mm256_extractf128_si256(gi, 1), 8)),
+                                              _mm_slli_epi32(_mm256_extractf128_si256(bi, 1), 16));
+            
+            // Store the data back + swap top and bottom rows
+            store_12_bytes(bot_address, _mm_shuffle_epi8(top_output, shuffle_pack));
+            store_12_bytes(top_address, _mm_shuffle_epi8(bot_output, shuffle_pack));
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u32 row_value = convert_pixel(load_pixel_24(row + x*3), saturation);
+            u32 opposite_value = convert_pixel(load_pixel_24(opposite_row + x*3), saturation);
+            
+            store_pixel_24(opposite_row + x*3, row_value);
+            store_pixel_24(row + x*3, opposite_value);
+        }
+    }
+    
+    // middle row for odd heights
+    if (height & 1)
+    {
+        u8 *row = memory + half_height*stride;
+        
+        for (u64 x = 0; x < width; x += 1)
+        {
+            store_pixel_24(row + x*3, convert_pixel(load_pixel_24(row + x*3), saturation));
+        }
+    }
+}
+
+static void image_swap_bytes_between_rgb_and_bgr_24(u32 width, u32 height, u8 *memory)
+{
+    image_convert_format_in_place(width, height, memory, image_stride_24(width), Pixel_Bgr, Pixel_Rgb, false);
+}
+
+static void image_flip_vertically_24(u32 width, u32 height, u8 *memory)
+{
+    u32 half_height = height / 2;
+    u32 stride = image_stride_24(width);
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u8 *row = memory + y*stride;
+        u8 *opposite_row = memory + (height - y - 1)*stride;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 32 <= stride; x += 32)
+        {
+            __m256i *top_address = (__m256i*)&row[x];
+            __m256i *bot_address = (__m256i*)&opposite_row[x];
+            __m256i top = _mm256_loadu_si256(top_address);
+            __m256i bot = _mm256_loadu_si256(bot_address);
+            _mm256_storeu_si256(top_address, bot);
+            _mm256_storeu_si256(bot_address, top);
+        }
+#endif
+        
+        // rows are whole u32s thanks to the padding
+        for (; x < stride; x += 4)
+        {
+            u32 temp = *(u32 *)&row[x];
+            *(u32 *)&row[x] = *(u32 *)&opposite_row[x];
+            *(u32 *)&opposite_row[x] = temp;
+        }
+    }
+}
+
+// gdi pixels -> packed (drops alpha)
+static void image_pack_24(u32 width, u32 height, u32 *source, u8 *destination)
+{
+    image_convert_format(width, height, (u8 *)source, width*4, Pixel_Bgra,
+                         destination, image_stride_24(width), Pixel_Bgr, false);
+}
+
+// packed -> gdi pixels (opaque)
+static void image_unpack_24(u32 width, u32 height, u8 *source, u32 *destination)
+{
+    image_convert_format(width, height, source, image_stride_24(width), Pixel_Bgr,
+                         (u8 *)destination, width*4, Pixel_Bgra, false);
+}
+
+
+
+
+////////////////////////////////
+// JPEG color conversion. stb_image.h lets us replace its YCbCr -> RGB row kernel (the IDCT
+// and upsampling keep using its own SSE2 kernels). Ours writes BGRA right away, so a decoded
+// JPEG only needs the vertical flip instead of a separate byte swap pass.
+// Same fixed point math as stb_image.h so the result is bit exact with its RGBA output.
+//
+// Saturation is free here: scaling the luminance/chroma difference is scaling Cb and Cr around 128,
+// and that folds into the four chroma constants. Note that this is BT.601 luma (what JPEG uses),
+// not the Rec. 709 luminance of convert_image, so strong saturation looks slightly different.
+
+// Set when the kernel ran - grayscale, CMYK and Adobe RGB JPEGs never call it and come out as RGBA
+static thread_local b32 jpeg_decoded_to_bgra;
+
+// Set by image_decode for the duration of the decode
+static thread_local f32 jpeg_chroma_saturation = 1.f;
+
+// Keeps the scaled 1.772 constant within s16 for the SSE path
+#define Ycbcr_Max_Saturation 4.f
+
+// Chroma constants in 12-bit fixed point with saturation folded in
+struct Ycbcr_Constants
+{
+    s16 cr_r, cr_g, cb_g, cb_b;
+};
+
+static Ycbcr_Constants ycbcr_constants(f32 saturation)
+{
+    saturation = clamp(0.f, saturation, Ycbcr_Max_Saturation);
+    
+    Ycbcr_Constants result;
+    result.cr_r =  (s16)(1.40200f*saturation*4096.f + 0.5f);
+    result.cr_g = -(s16)(0.71414f*saturation*4096.f + 0.5f);
+    result.cb_g = -(s16)(0.34414f*saturation*4096.f + 0.5f);
+    result.cb_b =  (s16)(1.77200f*saturation*4096.f + 0.5f);
+    return result;
+}
+
+static void jpeg_ycbcr_to_bgra_row(u8 *out, u8 const *y, u8 const *cb, u8 const *cr, int count, int step)
+{
+    jpeg_decoded_to_bgra = true;
+    Ycbcr_Constants constants = ycbcr_constants(jpeg_chroma_saturation);
+    int i = 0;
+    
+#if Use_Avx
+    if (step == 4)
+    {
+        __m128i signflip = _mm_set1_epi8(-0x80);
+        __m128i cr_const0 = _mm_set1_epi16(constants.cr_r);
+        __m128i cr_const1 = _mm_set1_epi16(constants.cr_g);
+        __m128i cb_const0 = _mm_set1_epi16(constants.cb_g);
+        __m128i cb_const1 = _mm_set1_epi16(constants.cb_b);
+        __m128i y_bias = _mm_set1_epi8((char)128);
+        __m128i alpha = _mm_set1_epi16(255);
+        
+        for (; i + 7 < count; i += 8)
+        {
+            __m128i y_bytes = _mm_loadl_epi64((__m128i *)(y + i));
+            __m128i cr_biased = _mm_xor_si128(_mm_loadl_epi64((__m128i *)(cr + i)), signflip); // -128
+            __m128i cb_biased = _mm_xor_si128(_mm_loadl_epi64((__m128i *)(cb + i)), signflip);
+            
+            // to 16 bits; cb and cr end up shifted left by 8
+            __m128i y_wide = _mm_srli_epi16(_mm_unpacklo_epi8(y_bias, y_bytes), 4);
+            __m128i cr_wide = _mm_unpacklo_epi8(_mm_setzero_si128(), cr_biased);
+            __m128i cb_wide = _mm_unpacklo_epi8(_mm_setzero_si128(), cb_biased);
+            
+            __m128i r = _mm_add_epi16(y_wide, _mm_mulhi_epi16(cr_const0, cr_wide));
+            __m128i g = _mm_add_epi16(_mm_add_epi16(y_wide, _mm_mulhi_epi16(cb_const0, cb_wide)),
+                                      _mm_mulhi_epi16(cr_wide, cr_const1));
+            __m128i b = _mm_add_epi16(y_wide, _mm_mulhi_epi16(cb_wide, cb_const1));
+            r = _mm_srai_epi16(r, 4);
+            g = _mm_srai_epi16(g, 4);
+            b = _mm_srai_epi16(b, 4);
+            
+            // b first - this is where the swap happens
+            __m128i br = _mm_packus_epi16(b, r);
+            __m128i ga = _mm_packus_epi16(g, alpha);
+            __m128i t0 = _mm_unpacklo_epi8(br, ga);
+            __m128i t1 = _mm_unpackhi_epi8(br, ga);
+            _mm_storeu_si128((__m128i *)(out + 0), _mm_unpacklo_epi16(t0, t1));
+            _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi16(t0, t1));
+            out += 32;
+        }
+    }
+#endif
+    
+    for (; i < count; i += 1)
+    {
+        int y_fixed = (y[i] << 20) + (1 << 19); // rounding
+        int cr_value = cr[i] - 128;
+        int cb_value = cb[i] - 128;
+        int r = y_fixed + cr_value*(constants.cr_r*256);
+        int g = y_fixed + cr_value*(constants.cr_g*256) + ((cb_value*(constants.cb_g*256)) & 0xFFFF0000);
+        int b = y_fixed + cb_value*(constants.cb_b*256);
+        r >>= 20;
+        g >>= 20;
+        b >>= 20;
+        out[0] = (u8)clamp(0, b, 255);
+        out[1] = (u8)clamp(0, g, 255);
+        out[2] = (u8)clamp(0, r, 255);
+        out[3] = 255;
+        out += step;
+    }
+}
+
+
+
+
+////////////////////////////////
+// Raw YUV frames (NV12 and I420, 8-bit 4:2:0 straight from capture hardware) to gdi format.
+// Limited range BT.601 like most capture paths and libyuv. Saturation scales Cb and Cr around 128
+// (same as for JPEGs) and the vertical flip is just where the rows are written, so a frame goes
+// to BGRA in one pass without an intermediate RGB buffer.
+enum Yuv_Format
+{
+    Yuv_Nv12, // Y plane, then one plane of interleaved U and V
+    Yuv_I420, // Y plane, U plane, V plane
+};
+
+struct Yuv_Frame
+{
+    u8 *y;
+    u8 *u, *v; // for NV12 v is u + 1
+    u32 chroma_stride;
+    u32 chroma_step; // bytes between chroma samples in a row: 2 for NV12, 1 for I420
+};
+
+// Everything that is the same for a whole frame; chroma coefficients have saturation folded in
+struct Yuv_Constants
+{
+    f32 y_scale, y_bias; // y_bias also has the 0.5 for rounding
+    f32 cr_r, cr_g, cb_g, cb_b;
+};
+
+static Yuv_Constants yuv_constants(f32 saturation)
+{
+    Yuv_Constants result;
+    result.y_scale = 1.164f;
+    result.y_bias = -16.f*1.164f + 0.5f;
+    result.cr_r =  1.596f*saturation;
+    result.cr_g = -0.813f*saturation;
+    result.cb_g = -0.392f*saturation;
+    result.cb_b =  2.017f*saturation;
+    return result;
+}
+
+static u64 yuv_frame_size(u32 width, u32 height)
+{
+    u64 chroma_width = (width + 1) / 2;
+    u64 chroma_height = (height + 1) / 2;
+    u64 result = (u64)width*height + 2*chroma_width*chroma_height;
+    return result;
+}
+
+static Yuv_Frame yuv_frame_from_memory(Yuv_Format format, u32 width, u32 height, u8 *memory)
+{
+    u32 chroma_width = (width + 1) / 2;
+    u32 chroma_height = (height + 1) / 2;
+    
+    Yuv_Frame result = {};
+    result.y = memory;
+    result.u = memory + (u64)width*height;
+    if (format == Yuv_Nv12)
+    {
+        result.v = result.u + 1;
+        result.chroma_stride = chroma_width*2;
+        result.chroma_step = 2;
+    }
+    else
+    {
+        result.v = result.u + (u64)chroma_width*chroma_height;
+        result.chroma_stride = chroma_width;
+        result.chroma_step = 1;
+    }
+    return result;
+}
+
+__forceinline static u32 yuv_to_bgra_pixel(u8 y, u8 u, u8 v, Yuv_Constants *constants)
+{
+    f32 y_term = (f32)y*constants->y_scale + constants->y_bias;
+    f32 cb = (f32)((s32)u - 128);
+    f32 cr = (f32)((s32)v - 128);
+    
+    f32 r = y_term + cr*constants->cr_r;
+    f32 g = y_term + (cb*constants->cb_g + cr*constants->cr_g);
+    f32 b = y_term + cb*constants->cb_b;
+    
+    u32 r255 = (u32)clamp(0.f, r, 255.f);
+    u32 g255 = (u32)clamp(0.f, g, 255.f);
+    u32 b255 = (u32)clamp(0.f, b, 255.f);
+    
+    u32 result = (0xFF00'0000 | (r255 << 16) | (g255 << 8) | b255);
+    return result;
+}
+
+static void yuv_row_to_bgra(u32 x, u32 width, u8 *y_row, u8 *u_row, u8 *v_row, u32 chroma_step,
+                            Yuv_Constants *constants, u32 *destination_row)
+{
+    for (; x < width; x += 1)
+    {
+        u32 chroma = (x / 2)*chroma_step;
+        destination_row[x] = yuv_to_bgra_pixel(y_row[x], u_row[chroma], v_row[chroma], constants);
+    }
+}
+
+// destination is width*height gdi pixels (bottom-up)
+static void convert_yuv_image(Yuv_Frame *frame, u32 width, u32 height, f32 saturation, u32 *destination)
+{
+    Yuv_Constants constants = yuv_constants(saturation);
+    u32 half_height = height / 2;
+    u32 simd_width = 0;
+    
+#if Use_Avx
+    // Like convert_image two rows make 8 float lanes - here the two luma rows that share a chroma row,
+    // so the chroma math is done once for 4 lanes and used for both.
+    simd_width = width & ~3u;
+    
+    // 4 chroma bytes (NV12: u0 v0 u1 v1) or 2 chroma bytes (I420: u0 u1) -> 4 lanes: c0 c0 c1 c1
+    __m128i nv12_u_shuffle = _mm_setr_epi8(0, -1, -1, -1, 0, -1, -1, -1, 2, -1, -1, -1, 2, -1, -1, -1);
+    __m128i nv12_v_shuffle = _mm_setr_epi8(1, -1, -1, -1, 1, -1, -1, -1, 3, -1, -1, -1, 3, -1, -1, -1);
+    __m128i i420_shuffle = _mm_setr_epi8(0, -1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 1, -1, -1, -1);
+    
+    __m128i ibias_128 = _mm_set1_epi32(128);
+    __m128i ialpha = _mm_set1_epi32(0xFF00'0000);
+    __m128 cr_r = _mm_set1_ps(constants.cr_r);
+    __m128 cr_g = _mm_set1_ps(constants.cr_g);
+    __m128 cb_g = _mm_set1_ps(constants.cb_g);
+    __m128 cb_b = _mm_set1_ps(constants.cb_b);
+    __m256 y_scale = _mm256_set1_ps(constants.y_scale);
+    __m256 y_bias = _mm256_set1_ps(constants.y_bias);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value255 = _mm256_set1_ps(255.f);
+    
+    for (u64 pair = 0; pair < half_height; pair += 1)
+    {
+        u8 *top_y = frame->y + (2*pair)*width;
+        u8 *bot_y = top_y + width;
+        u8 *u_row = frame->u + pair*frame->chroma_stride;
+        u8 *v_row = frame->v + pair*frame->chroma_stride;
+        u32 *top_destination = destination + (height - 2*pair - 1)*width;
+        u32 *bot_destination = top_destination - width;
+        
+        for (u64 x = 0; x < simd_width; x += 4)
+        {
+            // Chroma for 4 pixels
+            __m128i u, v;
+            if (frame->chroma_step == 2)
+            {
+                __m128i uv = _mm_cvtsi32_si128(*(int *)(u_row + x));
+                u = _mm_shuffle_epi8(uv, nv12_u_shuffle);
+                v = _mm_shuffle_epi8(uv, nv12_v_shuffle);
+            }
+            else
+            {
+                u = _mm_shuffle_epi8(_mm_cvtsi32_si128(*(u16 *)(u_row + x/2)), i420_shuffle);
+                v = _mm_shuffle_epi8(_mm_cvtsi32_si128(*(u16 *)(v_row + x/2)), i420_shuffle);
+            }
+            __m128 cb = _mm_cvtepi32_ps(_mm_sub_epi32(u, ibias_128));
+            __m128 cr = _mm_cvtepi32_ps(_mm_sub_epi32(v, ibias_128));
+            
+            __m128 r_term = _mm_mul_ps(cr, cr_r);
+            __m128 g_term = _mm_add_ps(_mm_mul_ps(cb, cb_g), _mm_mul_ps(cr, cr_g));
+            __m128 b_term = _mm_mul_ps(cb, cb_b);
+            
+            // {top_0, top_1, top_2, top_3, bot_0, bot_1, bot_2, bot_3}
+            __m256 r_wide = _mm256_insertf128_ps(_mm256_castps128_ps256(r_term), r_term, 1);
+            __m256 g_wide = _mm256_insertf128_ps(_mm256_castps128_ps256(g_term), g_term, 1);
+            __m256 b_wide = _mm256_insertf128_ps(_mm256_castps128_ps256(b_term), b_term, 1);
+            
+            __m128i top_luma = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(int *)(top_y + x)));
+            __m128i bot_luma = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(int *)(bot_y + x)));
+            __m256 luma = _mm256_cvtepi32_ps(_mm256_loadu2_m128i(&bot_luma, &top_luma));
+            __m256 y_term = _mm256_add_ps(_mm256_mul_ps(luma, y_scale), y_bias);
+            
+            __m256 r = _mm256_add_ps(y_term, r_wide);
+            __m256 g = _mm256_add_ps(y_term, g_wide);
+            __m256 b = _mm256_add_ps(y_term, b_wide);
+            
+            r = _mm256_max_ps(_mm256_min_ps(r, value255), value0);
+            g = _mm256_max_ps(_mm256_min_ps(g, value255), value0);
+            b = _mm256_max_ps(_mm256_min_ps(b, value255), value0);
+            
+            __m256i ri = _mm256_cvttps_epi32(r);
+            __m256i gi = _mm256_cvttps_epi32(g);
+            __m256i bi = _mm256_cvttps_epi32(b);
+            
+            __m128i top_output = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm256_extractf128_si256(ri, 0), 16),
+                                                           _mm_slli_epi32(_mm256_extractf128_si256(gi, 0), 8)),
+                                              _mm_or_si128(_mm256_extractf128_si256(bi, 0), ialpha));
+            __m128i bot_output = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm256_extractf128_si256(ri, 1), 16),
+                                                           _mm_slli_epi32(_mm256_extractf128_si256(gi, 1), 8)),
+                                              _mm_or_si128(_mm256_extractf128_si256(bi, 1), ialpha));
+            
+            _mm_storeu_si128((__m128i *)(top_destination + x), top_output);
+            _mm_storeu_si128((__m128i *)(bot_destination + x), bot_output);
+        }
+    }
+#endif
+    
+    for (u64 pair = 0; pair < half_height; pair += 1)
+    {
+        u8 *top_y = frame->y + (2*pair)*width;
+        u8 *u_row = frame->u + pair*frame->chroma_stride;
+        u8 *v_row = frame->v + pair*frame->chroma_stride;
+        u32 *top_destination = destination + (height - 2*pair - 1)*width;
+        
+        yuv_row_to_bgra(simd_width, width, top_y, u_row, v_row, frame->chroma_step, &constants, top_destination);
+        yuv_row_to_bgra(simd_width, width, top_y + width, u_row, v_row, frame->chroma_step, &constants,
+                        top_destination - width);
+    }
+    
+    // Odd heights - the last row has a chroma row of its own and ends up at the top of the buffer
+    if (height & 1)
+    {
+        u8 *u_row = frame->u + half_height*frame->chroma_stride;
+        u8 *v_row = frame->v + half_height*frame->chroma_stride;
+        yuv_row_to_bgra(0, width, frame->y + (u64)(height - 1)*width, u_row, v_row, frame->chroma_step,
+                        &constants, destination);
+    }
+}
+
+// Raw frames have no header - the format comes from the extension (.nv12, .i420 or .yuv for I420)
+// and the size from a "<width>x<height>" anywhere in the file name, e.g. capture_1920x1080.nv12
+static b32 yuv_format_from_path(char *path, Yuv_Format *format, u32 *width, u32 *height)
+{
+    char *name = path;
+    for (char *at = path; *at; at += 1)
+    {
+        if (*at == '/' || *at == '\\')
+        {
+            name = at + 1;
+        }
+    }
+    
+    char *extension = strrchr(name, '.');
+    if (!extension)
+    {
+        return false;
+    }
+    
+    if (_stricmp(extension, ".nv12") == 0)
+    {
+        *format = Yuv_Nv12;
+    }
+    else if (_stricmp(extension, ".i420") == 0 || _stricmp(extension, ".yuv") == 0)
+    {
+        *format = Yuv_I420;
+    }
+    else
+    {
+        return false;
+    }
+    
+    for (char *at = name; at < extension; at += 1)
+    {
+        u32 w = 0, h = 0;
+        if (*at >= '0' && *at <= '9' && sscanf(at, "%ux%u", &w, &h) == 2 && w && h)
+        {
+            *width = w;
+            *height = h;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_STATIC
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_HDR
+#define STBI_JPEG_YCBCR_TO_RGB_KERNEL jpeg_ycbcr_to_bgra_row
+#define STBI_ASSERT(x) assert(x)
+
+#define STBI_MALLOC(sz)                      image_alloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz)  image_realloc_sized(p, oldsz, newsz)
+#define STBI_FREE(p)                         image_free(p)
+
+// Allocations are aligned and padded to 64 bytes (a cache line) for images with width non-divisible by 4
+// so we don't touch memory beyond the end of the buffer with SSE/AVX instructions
+#define Image_Alignment 64
+
+// While image_decode runs this points to the decoding thread's arena, so all stb_image.h
+// temporaries are bump allocated and thrown away with a single arena_reset.
+// Outside of image_decode stb_image.h falls back to the aligned heap.
+static thread_local Memory_Arena *image_decode_arena_context;
+
+static void *image_alloc(size_t size)
+{
+    size_t padded_size = align_bin_to(size, (size_t)Image_Alignment);
+    
+    void *result = nullptr;
+    if (image_decode_arena_context)
+    {
+        result = arena_push(image_decode_arena_context, padded_size, Image_Alignment);
+    }
+    else
+    {
+        result = _aligned_malloc(padded_size, Image_Alignment);
+    }
+    return result;
+}
+
+static void *image_realloc_sized(void *memory, size_t old_size, size_t new_size)
+{
+    Memory_Arena *arena = image_decode_arena_context;
+    size_t padded_size = align_bin_to(new_size, (size_t)Image_Alignment);
+    
+    void *result = nullptr;
+    if (!memory)
+    {
+        result = image_alloc(new_size);
+    }
+    else if (arena && arena_owns(arena, memory))
+    {
+        // stb grows the zlib output buffer over and over - that is almost always the last allocation
+        if (arena_resize_last(arena, memory, padded_size))
+        {
+            result = memory;
+        }
+        else
+        {
+            result = arena_push(arena, padded_size, Image_Alignment);
+            if (result)
+            {
+                memcpy(result, memory, pick_smaller(old_size, new_size));
+            }
+        }
+    }
+    else
+    {
+        result = _aligned_realloc(memory, padded_size, Image_Alignment);
+    }
+    return result;
+}
+
+static void image_free(void *memory)
+{
+    Memory_Arena *arena = image_decode_arena_context;
+    if (arena && arena_owns(arena, memory))
+    {
+        arena_pop_last(arena, memory);
+    }
+    else
+    {
+        _aligned_free(memory);
+    }
+}
+
+#include "stb_image.h"
+
+
+
+
+
+
+static void image_swap_bytes_between_rgba_and_bgra(u32 width, u32 height, u32 *memory)
+{
+    convert_image_ops(width, height, memory, Convert_Swap, 1.f, nullptr);
+}
+
+static void image_flip_vertically(u32 width, u32 height, u32 *memory)
+{
+    convert_image_ops(width, height, memory, Convert_Flip, 1.f, nullptr);
+}
+
+
+
+
+
+static f32 color_linear_to_srgb(f32 l)
+{
+    f32 s;
+    if (l > 0.0031308f)
+    {
+        s = 1.055f*powf(l, 1.f/2.4f) - 0.055f;
+    }
+    else
+    {
+        s = l*12.92f;
+    }
+    return s;
+}
+
+static f32 color_srgb_to_linear(f32 s)
+{
+    f32 l;
+    if (s > 0.04045f)
+    {
+        l = powf(((s+0.055f) / 1.055f), 2.4f);
+    }
+    else
+    {
+        l = s / 12.92f;
+    }
+    return l;
+}
+
+
+////////////////////////////////
+// Oklab (Bjorn Ottosson's perceptual color space): linear sRGB -> LMS -> cube root -> L, a, b.
+// Saturation is scaling a and b (the chroma of OkLCh) with L and hue untouched.
+// Both matrices around that scale are linear, so lab_from_lms^-1 * diag(1, s, s) * lab_from_lms
+// collapses into one matrix (oklab_chroma_matrix) that works on the cube rooted LMS directly.
+static Color_Matrix oklab_lms_from_linear = {{
+    {0.4122214708f, 0.5363325363f, 0.0514459929f, 0.f},
+    {0.2119034982f, 0.6806995451f, 0.1073969566f, 0.f},
+    {0.0883024619f, 0.2817188376f, 0.6299787005f, 0.f},
+}};
+static Color_Matrix oklab_lab_from_lms = {{
+    {0.2104542553f,  0.7936177850f, -0.0040720468f, 0.f},
+    {1.9779984951f, -2.4285922050f,  0.4505937099f, 0.f},
+    {0.0259040371f,  0.7827717662f, -0.8086757660f, 0.f},
+}};
+static Color_Matrix oklab_lms_from_lab = {{
+    {1.f,  0.3963377774f,  0.2158037573f, 0.f},
+    {1.f, -0.1055613458f, -0.0638541728f, 0.f},
+    {1.f, -0.0894841775f, -1.2914855480f, 0.f},
+}};
+static Color_Matrix oklab_linear_from_lms = {{
+    { 4.0767416621f, -3.3077115913f,  0.2309699292f, 0.f},
+    {-1.2684380046f,  2.6097574011f, -0.3413193965f, 0.f},
+    {-0.0041960863f, -0.7034186147f,  1.7076147010f, 0.f},
+}};
+
+static Color_Matrix oklab_chroma_matrix(f32 saturation)
+{
+    Color_Matrix scale = {{
+        {1.f, 0.f, 0.f, 0.f},
+        {0.f, saturation, 0.f, 0.f},
+        {0.f, 0.f, saturation, 0.f},
+    }};
+    Color_Matrix scaled = color_matrix_multiply(&scale, &oklab_lab_from_lms);
+    Color_Matrix result = color_matrix_multiply(&oklab_lms_from_lab, &scaled);
+    return result;
+}
+
+// linear rgb in and out
+static v3 oklab_saturate_linear(v3 linear, Color_Matrix *chroma)
+{
+    v3 lms = color_matrix_transform(&oklab_lms_from_linear, linear);
+    lms.x = cbrtf(lms.x);
+    lms.y = cbrtf(lms.y);
+    lms.z = cbrtf(lms.z);
+    lms = color_matrix_transform(chroma, lms);
+    lms.x = lms.x*lms.x*lms.x;
+    lms.y = lms.y*lms.y*lms.y;
+    lms.z = lms.z*lms.z*lms.z;
+    v3 result = color_matrix_transform(&oklab_linear_from_lms, lms);
+    return result;
+}
+
+
+enum Saturation_Type
+{
+    Saturation_Hsv,
+    Saturation_Hsl,
+    Saturation_Luminance_Srgb,
+    Saturation_Luminance_Linear,
+    Saturation_Oklab,
+};
+
+// SIMD version of Saturation_Oklab, below the linear light tables it uses
+static void image_saturate_oklab(u32 width, u32 height, u32 *memory, f32 saturation, Image_Stats *stats);
+
+// stats may be null; the channel in the low byte counts as red for them, like in this function
+static void image_saturate(u32 width, u32 height, u32 *memory,
+                           f32 saturation, Saturation_Type saturation_type, Image_Stats *stats)
+{
+#if Use_Avx
+    if (saturation_type == Saturation_Oklab)
+    {
+        image_saturate_oklab(width, height, memory, saturation, stats);
+        return;
+    }
+#endif
+    
+    Color_Matrix oklab_chroma = oklab_chroma_matrix(saturation);
+    
+    for (u64 y = 0; y < height; y += 1)
+    {
+        u32 *row = memory + y*width;
+        
+        for (u64 x = 0; x < width; x += 1)
+        {
+            u32 value = row[x];
+            
+            // this is assuming that our image is in RGBA (R in bottom bits) format now
+            v3 source = {
+                (f32)(value         & 0xFF) / 255.f,
+                (f32)((value >> 8)  & 0xFF) / 255.f,
+                (f32)((value >> 16) & 0xFF) / 255.f,
+            };
+            
+            v3 out = {};
+            
+            switch (saturation_type)
+            {
+                case Saturation_Hsv:
+                {
+                    Color_Hsv hsv = hsv_from_rgb(source);
+                    hsv.s *= saturation;
+                    out = rgb_from_hsv(hsv);
+                } break;
+                
+                case Saturation_Hsl:
+                {
+                    Color_Hsl hsl = hsl_from_rgb(source);
+                    hsl.s *= saturation;
+                    out = rgb_from_hsl(hsl);
+                } break;
+                
+                case Saturation_Luminance_Srgb:
+                {
+                    f32 luminance = (source.r * 0.2126f +
+                                     source.g * 0.7152f +
+                                     source.b * 0.0722f);
+                    v3 gray = {luminance, luminance, luminance};
+                    v3 diff = source - gray;
+                    diff *= saturation;
+                    
+                    out = (gray + diff);
+                } break;
+                
+                case Saturation_Luminance_Linear:
+                {
+                    source.r = color_srgb_to_linear(source.r);
+                    source.g = color_srgb_to_linear(source.g);
+                    source.b = color_srgb_to_linear(source.b);
+                    
+                    f32 luminance = (source.r * 0.2126f +
+                                     source.g * 0.7152f +
+                                     source.b * 0.0722f);
+                    v3 gray = {luminance, luminance, luminance};
+                    v3 diff = source - gray;
+                    diff *= saturation;
+                    
+                    out = (gray + diff);
+                    out.r = color_linear_to_srgb(out.r);
+                    out.g = color_linear_to_srgb(out.g);
+                    out.b = color_linear_to_srgb(out.b);
+                } break;
+                
+                case Saturation_Oklab:
+                {
+                    // Oklab is not symmetric in the channels, so red has to be the low byte like above
+                    v3 linear = {
+                        color_srgb_to_linear(source.r),
+                        color_srgb_to_linear(source.g),
+                        color_srgb_to_linear(source.b),
+                    };
+                    linear = oklab_saturate_linear(linear, &oklab_chroma);
+                    
+                    // clipping happens in linear light here
+                    out.r = color_linear_to_srgb(linear.r);
+                    out.g = color_linear_to_srgb(linear.g);
+                    out.b = color_linear_to_srgb(linear.b);
+                } break;
+            };
+            
+            
+            b32 clipped = (out.x < 0.f || out.x > 1.f ||
+                           out.y < 0.f || out.y > 1.f ||
+                           out.z < 0.f || out.z > 1.f);
+            out = clamp01(out);
+            row[x] = ((value & 0xFF00'0000) |
+                      (u32)(out.z * 255.f) << 16 |
+                      (u32)(out.y * 255.f) << 8 |
+                      (u32)(out.x * 255.f));
+            if (stats)
+            {
+                image_stats_add(stats, (u32)(out.x * 255.f), (u32)(out.y * 255.f), (u32)(out.z * 255.f), clipped);
+            }
+        }
+    }
+}
+
+
+
+
+
+////////////////////////////////
+// Linear light working buffer: three planes (red, green, blue) of half floats, same pixel order
+// as the gdi buffer. It is built once from the 8-bit image; after that repeated saturation
+// edits run directly on linear values and skip the sRGB transfer functions.
+// Half floats use half the memory of f32 and convert in one F16C instruction per 8 values.
+// Values are not clamped inside the buffer - only when the display image is written out.
+#define Linear_Encode_Table_Size 4096
+
+static f32 linear_from_srgb_table[256];
+static u8 srgb_from_linear_table[Linear_Encode_Table_Size];
+
+static void linear_tables_init()
+{
+    if (linear_from_srgb_table[255] == 0.f)
+    {
+        for (u32 i = 0; i < 256; i += 1)
+        {
+            linear_from_srgb_table[i] = color_srgb_to_linear((f32)i / 255.f);
+        }
+        
+        for (u32 i = 0; i < Linear_Encode_Table_Size; i += 1)
+        {
+            f32 srgb = color_linear_to_srgb((f32)i / (f32)(Linear_Encode_Table_Size - 1));
+            srgb_from_linear_table[i] = (u8)(clamp01(srgb)*255.f + 0.5f);
+        }
+    }
+}
+
+__forceinline static u32 srgb_encode_table_index(f32 linear)
+{
+    u32 result = (u32)(clamp01(linear)*(f32)(Linear_Encode_Table_Size - 1) + 0.5f);
+    return result;
+}
+
+
+struct Linear_Buffer
+{
+    u16 *memory;
+    u16 *r, *g, *b;
+    u32 width, height;
+};
+
+static u64 linear_buffer_size(u32 width, u32 height)
+{
+    // every plane starts on Image_Alignment
+    u64 plane_size = align_bin_to((u64)width*height*sizeof(u16), (u64)Image_Alignment);
+    return 3*plane_size;
+}
+
+static Linear_Buffer linear_buffer_from_image(u32 width, u32 height, u32 *source, u16 *memory)
+{
+    linear_tables_init();
+    
+    u64 plane_count = align_bin_to((u64)width*height*sizeof(u16), (u64)Image_Alignment) / sizeof(u16);
+    Linear_Buffer result = {};
+    result.memory = memory;
+    result.r = memory;
+    result.g = memory + plane_count;
+    result.b = memory + 2*plane_count;
+    result.width = width;
+    result.height = height;
+    
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        // no gather on AVX1 - table lookups stay scalar
+        f32 r[8], g[8], b[8];
+        for (u32 lane = 0; lane < 8; lane += 1)
+        {
+            u32 value = source[i + lane];
+            r[lane] = linear_from_srgb_table[(value >> 16) & 0xFF];
+            g[lane] = linear_from_srgb_table[(value >> 8) & 0xFF];
+            b[lane] = linear_from_srgb_table[value & 0xFF];
+        }
+        
+        _mm_storeu_si128((__m128i*)&result.r[i], _mm256_cvtps_ph(_mm256_loadu_ps(r), _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)&result.g[i], _mm256_cvtps_ph(_mm256_loadu_ps(g), _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)&result.b[i], _mm256_cvtps_ph(_mm256_loadu_ps(b), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        u32 value = source[i];
+        result.r[i] = half_from_f32(linear_from_srgb_table[(value >> 16) & 0xFF]);
+        result.g[i] = half_from_f32(linear_from_srgb_table[(value >> 8) & 0xFF]);
+        result.b[i] = half_from_f32(linear_from_srgb_table[value & 0xFF]);
+    }
+    
+    return result;
+}
+
+static void linear_buffer_saturate(Linear_Buffer *buffer, f32 saturation)
+{
+    u64 pixel_count = (u64)buffer->width*buffer->height;
+    u64 i = 0;
+    
+#if Use_Avx
+    __m256 coef_r = _mm256_set1_ps(0.2126f);
+    __m256 coef_g = _mm256_set1_ps(0.7152f);
+    __m256 coef_b = _mm256_set1_ps(0.0722f);
+    __m256 saturation_wide = _mm256_set1_ps(saturation);
+    
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m128i *r_address = (__m128i*)&buffer->r[i];
+        __m128i *g_address = (__m128i*)&buffer->g[i];
+        __m128i *b_address = (__m128i*)&buffer->b[i];
+        __m256 r = _mm256_cvtph_ps(_mm_loadu_si128(r_address));
+        __m256 g = _mm256_cvtph_ps(_mm_loadu_si128(g_address));
+        __m256 b = _mm256_cvtph_ps(_mm_loadu_si128(b_address));
+        
+        __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+        luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+        
+        r = _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(r, luminance), saturation_wide));
+        g = _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(g, luminance), saturation_wide));
+        b = _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(b, luminance), saturation_wide));
+        
+        _mm_storeu_si128(r_address, _mm256_cvtps_ph(r, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128(g_address, _mm256_cvtps_ph(g, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128(b_address, _mm256_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        v3 source = {
+            f32_from_half(buffer->r[i]),
+            f32_from_half(buffer->g[i]),
+            f32_from_half(buffer->b[i]),
+        };
+        
+        f32 luminance = (source.r * 0.2126f +
+                         source.g * 0.7152f +
+                         source.b * 0.0722f);
+        v3 gray = {luminance, luminance, luminance};
+        v3 out = gray + (source - gray)*saturation;
+        
+        buffer->r[i] = half_from_f32(out.r);
+        buffer->g[i] = half_from_f32(out.g);
+        buffer->b[i] = half_from_f32(out.b);
+    }
+}
+
+// Writes sRGB pixels in gdi format; alpha of the destination is kept
+static void image_from_linear_buffer(Linear_Buffer *buffer, u32 *destination)
+{
+    linear_tables_init();
+    
+    u64 pixel_count = (u64)buffer->width*buffer->height;
+    u64 i = 0;
+    
+#if Use_Avx
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 table_scale = _mm256_set1_ps((f32)(Linear_Encode_Table_Size - 1));
+    __m256 value_half = _mm256_set1_ps(0.5f);
+    
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m256 r = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&buffer->r[i]));
+        __m256 g = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&buffer->g[i]));
+        __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&buffer->b[i]));
+        
+        r = _mm256_max_ps(_mm256_min_ps(r, value1), value0);
+        g = _mm256_max_ps(_mm256_min_ps(g, value1), value0);
+        b = _mm256_max_ps(_mm256_min_ps(b, value1), value0);
+        
+        s32 r_index[8], g_index[8], b_index[8];
+        _mm256_storeu_si256((__m256i*)r_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(r, table_scale), value_half)));
+        _mm256_storeu_si256((__m256i*)g_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(g, table_scale), value_half)));
+        _mm256_storeu_si256((__m256i*)b_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, table_scale), value_half)));
+        
+        for (u32 lane = 0; lane < 8; lane += 1)
+        {
+            destination[i + lane] = ((destination[i + lane] & 0xFF00'0000) |
+                                     ((u32)srgb_from_linear_table[r_index[lane]] << 16) |
+                                     ((u32)srgb_from_linear_table[g_index[lane]] << 8) |
+                                     (u32)srgb_from_linear_table[b_index[lane]]);
+        }
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        u32 r = srgb_from_linear_table[srgb_encode_table_index(f32_from_half(buffer->r[i]))];
+        u32 g = srgb_from_linear_table[srgb_encode_table_index(f32_from_half(buffer->g[i]))];
+        u32 b = srgb_from_linear_table[srgb_encode_table_index(f32_from_half(buffer->b[i]))];
+        destination[i] = ((destination[i] & 0xFF00'0000) | (r << 16) | (g << 8) | b);
+    }
+}
+
+// convert_pixel in linear light: sRGB decode and encode through the tables, no powf.
+// Alpha is kept.
+template <b32 Swap>
+__forceinline static u32 convert_pixel_linear(u32 value, f32 saturation)
+{
+    f32 r = linear_from_srgb_table[(value >> 16) & 0xFF];
+    f32 g = linear_from_srgb_table[(value >> 8) & 0xFF];
+    f32 b = linear_from_srgb_table[value & 0xFF];
+    
+    f32 luminance = (r * 0.2126f +
+                     g * 0.7152f +
+                     b * 0.0722f);
+    r = luminance + (r - luminance)*saturation;
+    g = luminance + (g - luminance)*saturation;
+    b = luminance + (b - luminance)*saturation;
+    
+    u32 r255 = srgb_from_linear_table[srgb_encode_table_index(r)];
+    u32 g255 = srgb_from_linear_table[srgb_encode_table_index(g)];
+    u32 b255 = srgb_from_linear_table[srgb_encode_table_index(b)];
+    
+    u32 result = ((value & 0xFF00'0000) |
+                  (Swap ? ((b255 << 16) | (g255 << 8) | r255) : ((r255 << 16) | (g255 << 8) | b255)));
+    return result;
+}
+
+// Same shape as convert_image_saturate (top/bottom row pairs, Swap/Flip resolved at compile time).
+// The math is 8 wide; the table lookups are scalar because AVX1 has no gather.
+template <b32 Swap, b32 Flip>
+static void convert_image_saturate_linear(u32 width, u32 height, u32 *memory, float saturation)
+{
+    linear_tables_init();
+    u32 half_height = height / 2;
+    
+#if Use_Avx
+    __m256 coef_r = _mm256_set1_ps(0.2126f);
+    __m256 coef_g = _mm256_set1_ps(0.7152f);
+    __m256 coef_b = _mm256_set1_ps(0.0722f);
+    __m256 saturation_wide = _mm256_set1_ps(saturation);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 table_scale = _mm256_set1_ps((f32)(Linear_Encode_Table_Size - 1));
+    __m256 value_half = _mm256_set1_ps(0.5f);
+    u32 r_shift = (Swap ? 0 : 16);
+    u32 b_shift = (Swap ? 16 : 0);
+#endif
+    
+    for (u64 y = 0; y < half_height; y += 1)
+    {
+        u32 *row = memory + y*width;
+        u32 *opposite_row = memory + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 4 <= width; x += 4)
+        {
+            // lanes 0-3 from the top row, 4-7 from the bottom row
+            u32 input[8];
+            _mm_storeu_si128((__m128i*)&input[0], _mm_loadu_si128((__m128i*)&row[x]));
+            _mm_storeu_si128((__m128i*)&input[4], _mm_loadu_si128((__m128i*)&opposite_row[x]));
+            
+            f32 r_linear[8], g_linear[8], b_linear[8];
+            for (u32 lane = 0; lane < 8; lane += 1)
+            {
+                r_linear[lane] = linear_from_srgb_table[(input[lane] >> 16) & 0xFF];
+                g_linear[lane] = linear_from_srgb_table[(input[lane] >> 8) & 0xFF];
+                b_linear[lane] = linear_from_srgb_table[input[lane] & 0xFF];
+            }
+            __m256 r = _mm256_loadu_ps(r_linear);
+            __m256 g = _mm256_loadu_ps(g_linear);
+            __m256 b = _mm256_loadu_ps(b_linear);
+            
+            __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+            luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+            
+            r = _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(r, luminance), saturation_wide));
+            g = _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(g, luminance), saturation_wide));
+            b = _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(b, luminance), saturation_wide));
+            
+            r = _mm256_max_ps(_mm256_min_ps(r, value1), value0);
+            g = _mm256_max_ps(_mm256_min_ps(g, value1), value0);
+            b = _mm256_max_ps(_mm256_min_ps(b, value1), value0);
+            
+            s32 r_index[8], g_index[8], b_index[8];
+            _mm256_storeu_si256((__m256i*)r_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(r, table_scale), value_half)));
+            _mm256_storeu_si256((__m256i*)g_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(g, table_scale), value_half)));
+            _mm256_storeu_si256((__m256i*)b_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, table_scale), value_half)));
+            
+            u32 output[8];
+            for (u32 lane = 0; lane < 8; lane += 1)
+            {
+                output[lane] = ((input[lane] & 0xFF00'0000) |
+                                ((u32)srgb_from_linear_table[r_index[lane]] << r_shift) |
+                                ((u32)srgb_from_linear_table[g_index[lane]] << 8) |
+                                ((u32)srgb_from_linear_table[b_index[lane]] << b_shift));
+            }
+            
+            _mm_storeu_si128((__m128i*)&(Flip ? opposite_row : row)[x], _mm_loadu_si128((__m128i*)&output[0]));
+            _mm_storeu_si128((__m128i*)&(Flip ? row : opposite_row)[x], _mm_loadu_si128((__m128i*)&output[4]));
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u32 row_value = convert_pixel_linear<Swap>(row[x], saturation);
+            u32 opposite_value = convert_pixel_linear<Swap>(opposite_row[x], saturation);
+            (Flip ? opposite_row : row)[x] = row_value;
+            (Flip ? row : opposite_row)[x] = opposite_value;
+        }
+    }
+    
+    // middle row for odd heights
+    if (height & 1)
+    {
+        u32 *row = memory + half_height*width;
+        for (u64 x = 0; x < width; x += 1)
+        {
+            row[x] = convert_pixel_linear<Swap>(row[x], saturation);
+        }
+    }
+}
+
+#if Use_Avx
+// Cube root of non-negative values: exponent / 3 bit trick for the first guess, then two Newton steps
+// (about 5% -> 0.3% -> 0.001% error, plenty for 8-bit output)
+__forceinline static __m256 cbrt_8(__m256 x)
+{
+    // bits/3 + bias in float math - AVX has no 256 bit integer ops
+    __m256 bits = _mm256_cvtepi32_ps(_mm256_castps_si256(x));
+    bits = _mm256_add_ps(_mm256_mul_ps(bits, _mm256_set1_ps(1.f/3.f)), _mm256_set1_ps(709921077.f));
+    __m256 y = _mm256_castsi256_ps(_mm256_cvttps_epi32(bits));
+    
+    __m256 third = _mm256_set1_ps(1.f/3.f);
+    __m256 two = _mm256_set1_ps(2.f);
+    for (u32 i = 0; i < 2; i += 1)
+    {
+        // y = (2y + x/y^2) / 3
+        y = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(two, y), _mm256_div_ps(x, _mm256_mul_ps(y, y))), third);
+    }
+    return y;
+}
+
+__forceinline static void color_matrix_transform_8(Color_Matrix *matrix, __m256 *x, __m256 *y, __m256 *z)
+{
+    __m256 in[3] = {*x, *y, *z};
+    __m256 out[3];
+    for (u32 row = 0; row < 3; row += 1)
+    {
+        f32 *m = matrix->m[row];
+        __m256 sum = _mm256_mul_ps(in[0], _mm256_set1_ps(m[0]));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(in[1], _mm256_set1_ps(m[1])));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(in[2], _mm256_set1_ps(m[2])));
+        out[row] = sum;
+    }
+    *x = out[0];
+    *y = out[1];
+    *z = out[2];
+}
+#endif
+
+// Saturation_Oklab: red is the low byte like in image_saturate. sRGB decode and encode go through the linear light tables, everything in between
+// is 8 pixels wide. Alpha is kept. Stats may be null.
+static void image_saturate_oklab(u32 width, u32 height, u32 *memory, f32 saturation, Image_Stats *stats)
+{
+    linear_tables_init();
+    
+    Color_Matrix chroma = oklab_chroma_matrix(saturation);
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    Image_Stats_Lanes lanes;
+    if (stats)
+    {
+        image_stats_lanes_begin(&lanes);
+    }
+    
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 table_scale = _mm256_set1_ps((f32)(Linear_Encode_Table_Size - 1));
+    __m256 value_half = _mm256_set1_ps(0.5f);
+    
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        // no gather on AVX1 - table lookups stay scalar
+        f32 r_linear[8], g_linear[8], b_linear[8];
+        for (u32 lane = 0; lane < 8; lane += 1)
+        {
+            u32 value = memory[i + lane];
+            r_linear[lane] = linear_from_srgb_table[value & 0xFF];
+            g_linear[lane] = linear_from_srgb_table[(value >> 8) & 0xFF];
+            b_linear[lane] = linear_from_srgb_table[(value >> 16) & 0xFF];
+        }
+        
+        __m256 l = _mm256_loadu_ps(r_linear);
+        __m256 m = _mm256_loadu_ps(g_linear);
+        __m256 s = _mm256_loadu_ps(b_linear);
+        color_matrix_transform_8(&oklab_lms_from_linear, &l, &m, &s);
+        l = cbrt_8(l);
+        m = cbrt_8(m);
+        s = cbrt_8(s);
+        color_matrix_transform_8(&chroma, &l, &m, &s);
+        l = _mm256_mul_ps(_mm256_mul_ps(l, l), l);
+        m = _mm256_mul_ps(_mm256_mul_ps(m, m), m);
+        s = _mm256_mul_ps(_mm256_mul_ps(s, s), s);
+        color_matrix_transform_8(&oklab_linear_from_lms, &l, &m, &s);
+        
+        __m256 clipped = value0;
+        if (stats)
+        {
+            __m256 low = _mm256_min_ps(_mm256_min_ps(l, m), s);
+            __m256 high = _mm256_max_ps(_mm256_max_ps(l, m), s);
+            clipped = _mm256_or_ps(_mm256_cmp_ps(low, value0, _CMP_LT_OQ), _mm256_cmp_ps(high, value1, _CMP_GT_OQ));
+        }
+        
+        __m256 r = _mm256_max_ps(_mm256_min_ps(l, value1), value0);
+        __m256 g = _mm256_max_ps(_mm256_min_ps(m, value1), value0);
+        __m256 b = _mm256_max_ps(_mm256_min_ps(s, value1), value0);
+        
+        s32 r_index[8], g_index[8], b_index[8];
+        _mm256_storeu_si256((__m256i*)r_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(r, table_scale), value_half)));
+        _mm256_storeu_si256((__m256i*)g_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(g, table_scale), value_half)));
+        _mm256_storeu_si256((__m256i*)b_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, table_scale), value_half)));
+        
+        for (u32 lane = 0; lane < 8; lane += 1)
+        {
+            memory[i + lane] = ((memory[i + lane] & 0xFF00'0000) |
+                                ((u32)srgb_from_linear_table[b_index[lane]] << 16) |
+                                ((u32)srgb_from_linear_table[g_index[lane]] << 8) |
+                                (u32)srgb_from_linear_table[r_index[lane]]);
+        }
+        
+        if (stats)
+        {
+            // the low byte counts as red, like in image_saturate
+            __m128i imask_FF = _mm_set1_epi32(0xFF);
+            __m128i lo = _mm_loadu_si128((__m128i*)&memory[i]);
+            __m128i hi = _mm_loadu_si128((__m128i*)&memory[i + 4]);
+            __m256 r_out = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(lo, imask_FF), _mm_and_si128(hi, imask_FF)));
+            __m256 g_out = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 8), imask_FF),
+                                                                _mm_and_si128(_mm_srli_epi32(hi, 8), imask_FF)));
+            __m256 b_out = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 16), imask_FF),
+                                                                _mm_and_si128(_mm_srli_epi32(hi, 16), imask_FF)));
+            image_stats_lanes_add_8(&lanes, r_out, g_out, b_out, clipped, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+        }
+    }
+    
+    if (stats)
+    {
+        image_stats_lanes_end(&lanes, stats);
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        u32 value = memory[i];
+        v3 linear = {
+            linear_from_srgb_table[value & 0xFF],
+            linear_from_srgb_table[(value >> 8) & 0xFF],
+            linear_from_srgb_table[(value >> 16) & 0xFF],
+        };
+        linear = oklab_saturate_linear(linear, &chroma);
+        
+        u32 r = srgb_from_linear_table[srgb_encode_table_index(linear.r)];
+        u32 g = srgb_from_linear_table[srgb_encode_table_index(linear.g)];
+        u32 b = srgb_from_linear_table[srgb_encode_table_index(linear.b)];
+        memory[i] = ((value & 0xFF00'0000) | (b << 16) | (g << 8) | r);
+        if (stats)
+        {
+            b32 clipped = (pick_smaller(pick_smaller(linear.r, linear.g), linear.b) < 0.f ||
+                           pick_bigger(pick_bigger(linear.r, linear.g), linear.b) > 1.f);
+            image_stats_add(stats, r, g, b, clipped);
+        }
+    }
+}
+
+
+
+
+
+////////////////////////////////
+// Luminance/chroma planes for rendering one image at many saturation values (scrubbing the saturation,
+// contact sheets). convert_pixel is luminance + (channel - luminance)*saturation, so the luminance and
+// the three differences are computed once; after that every output is one multiply-add per channel
+// and a pack. The output is what convert_image would make (swapped and flipped) into a separate buffer,
+// so the planes stay untouched for the next saturation value.
+// Planes are half floats like Linear_Buffer, plus the alpha bytes: 9 bytes per pixel.
+struct Chroma_Planes
+{
+    u16 *memory;
+    u16 *luminance;
+    u16 *r, *g, *b; // differences from the luminance
+    u8 *alpha;
+    u32 width, height;
+};
+
+static u64 chroma_planes_size(u32 width, u32 height)
+{
+    // every plane starts on Image_Alignment
+    u64 half_plane_size = align_bin_to((u64)width*height*sizeof(u16), (u64)Image_Alignment);
+    u64 alpha_plane_size = align_bin_to((u64)width*height, (u64)Image_Alignment);
+    return 4*half_plane_size + alpha_plane_size;
+}
+
+static Chroma_Planes chroma_planes_from_image(u32 width, u32 height, u32 *source, u16 *memory)
+{
+    u64 plane_count = align_bin_to((u64)width*height*sizeof(u16), (u64)Image_Alignment) / sizeof(u16);
+    Chroma_Planes result = {};
+    result.memory = memory;
+    result.luminance = memory;
+    result.r = memory + plane_count;
+    result.g = memory + 2*plane_count;
+    result.b = memory + 3*plane_count;
+    result.alpha = (u8 *)(memory + 4*plane_count);
+    result.width = width;
+    result.height = height;
+    
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    __m128i imask_FF = _mm_set1_epi32(0xFF);
+    __m256 coef_r = _mm256_set1_ps(0.2126f);
+    __m256 coef_g = _mm256_set1_ps(0.7152f);
+    __m256 coef_b = _mm256_set1_ps(0.0722f);
+    
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128((__m128i*)&source[i]);
+        __m128i hi = _mm_loadu_si128((__m128i*)&source[i + 4]);
+        
+        __m256 r = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 16), imask_FF),
+                                                        _mm_and_si128(_mm_srli_epi32(hi, 16), imask_FF)));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(_mm_srli_epi32(lo, 8), imask_FF),
+                                                        _mm_and_si128(_mm_srli_epi32(hi, 8), imask_FF)));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_setr_m128i(_mm_and_si128(lo, imask_FF),
+                                                        _mm_and_si128(hi, imask_FF)));
+        
+        __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+        luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+        
+        _mm_storeu_si128((__m128i*)&result.luminance[i], _mm256_cvtps_ph(luminance, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)&result.r[i], _mm256_cvtps_ph(_mm256_sub_ps(r, luminance), _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)&result.g[i], _mm256_cvtps_ph(_mm256_sub_ps(g, luminance), _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)&result.b[i], _mm256_cvtps_ph(_mm256_sub_ps(b, luminance), _MM_FROUND_TO_NEAREST_INT));
+        
+        // top bytes of the 8 pixels
+        __m128i alpha_shuffle = _mm_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        __m128i alpha = _mm_unpacklo_epi32(_mm_shuffle_epi8(lo, alpha_shuffle), _mm_shuffle_epi8(hi, alpha_shuffle));
+        _mm_storel_epi64((__m128i*)&result.alpha[i], alpha);
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        u32 value = source[i];
+        f32 r = (f32)((value >> 16) & 0xFF);
+        f32 g = (f32)((value >> 8)  & 0xFF);
+        f32 b = (f32)(value         & 0xFF);
+        f32 luminance = (r * 0.2126f +
+                         g * 0.7152f +
+                         b * 0.0722f);
+        
+        result.luminance[i] = half_from_f32(luminance);
+        result.r[i] = half_from_f32(r - luminance);
+        result.g[i] = half_from_f32(g - luminance);
+        result.b[i] = half_from_f32(b - luminance);
+        result.alpha[i] = (u8)(value >> 24);
+    }
+    
+    return result;
+}
+
+// convert_image(saturation) of the decomposed image into destination (width*height pixels).
+// Alpha is kept. Half float planes make it accurate to 1 of convert_image, not bit exact.
+static void image_from_chroma_planes(Chroma_Planes *planes, f32 saturation, u32 *destination)
+{
+    u32 width = planes->width;
+    u32 height = planes->height;
+    
+#if Use_Avx
+    __m256 saturation_wide = _mm256_set1_ps(saturation);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value255 = _mm256_set1_ps(255.f);
+#endif
+    
+    for (u64 y = 0; y < height; y += 1)
+    {
+        u64 source_offset = y*width;
+        u32 *destination_row = destination + (height - y - 1)*width;
+        u64 x = 0;
+        
+#if Use_Avx
+        for (; x + 8 <= width; x += 8)
+        {
+            u64 i = source_offset + x;
+            __m256 luminance = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&planes->luminance[i]));
+            __m256 r = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&planes->r[i]));
+            __m256 g = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&planes->g[i]));
+            __m256 b = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)&planes->b[i]));
+            
+            r = _mm256_add_ps(luminance, _mm256_mul_ps(r, saturation_wide));
+            g = _mm256_add_ps(luminance, _mm256_mul_ps(g, saturation_wide));
+            b = _mm256_add_ps(luminance, _mm256_mul_ps(b, saturation_wide));
+            
+            __m256i ri = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(r, value255), value0));
+            __m256i gi = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(g, value255), value0));
+            __m256i bi = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_min_ps(b, value255), value0));
+            
+            // 8 x u32 -> 8 bytes per channel, then interleaved to r, g, b, a bytes (the swap of convert_image)
+            __m128i r8 = _mm_packus_epi16(_mm_packus_epi32(_mm256_extractf128_si256(ri, 0), _mm256_extractf128_si256(ri, 1)), _mm_setzero_si128());
+            __m128i g8 = _mm_packus_epi16(_mm_packus_epi32(_mm256_extractf128_si256(gi, 0), _mm256_extractf128_si256(gi, 1)), _mm_setzero_si128());
+            __m128i b8 = _mm_packus_epi16(_mm_packus_epi32(_mm256_extractf128_si256(bi, 0), _mm256_extractf128_si256(bi, 1)), _mm_setzero_si128());
+            __m128i a8 = _mm_loadl_epi64((__m128i*)&planes->alpha[i]);
+            
+            __m128i rg = _mm_unpacklo_epi8(r8, g8);
+            __m128i ba = _mm_unpacklo_epi8(b8, a8);
+            _mm_storeu_si128((__m128i*)&destination_row[x], _mm_unpacklo_epi16(rg, ba));
+            _mm_storeu_si128((__m128i*)&destination_row[x + 4], _mm_unpackhi_epi16(rg, ba));
+        }
+#endif
+        
+        for (; x < width; x += 1)
+        {
+            u64 i = source_offset + x;
+            f32 luminance = f32_from_half(planes->luminance[i]);
+            u32 r = (u32)clamp(0.f, luminance + f32_from_half(planes->r[i])*saturation, 255.f);
+            u32 g = (u32)clamp(0.f, luminance + f32_from_half(planes->g[i])*saturation, 255.f);
+            u32 b = (u32)clamp(0.f, luminance + f32_from_half(planes->b[i])*saturation, 255.f);
+            destination_row[x] = (((u32)planes->alpha[i] << 24) | (b << 16) | (g << 8) | r);
+        }
+    }
+}
+
+
+
+
+
+////////////////////////////////
+// Float pipeline for Radiance HDR images: linear light f32 red, green and blue planes, rows in gdi order.
+// Saturation runs on the unclamped values and only the display image gets tone mapped and quantized.
+struct Hdr_Planes
+{
+    f32 *memory; // one allocation for all three planes
+    f32 *r, *g, *b;
+};
+
+static u64 hdr_planes_size(u32 width, u32 height)
+{
+    u64 plane_size = align_bin_to((u64)width*height*sizeof(f32), (u64)Image_Alignment);
+    return 3*plane_size;
+}
+
+// source is interleaved RGB, top-down (stbi_loadf) - it gets split into planes and flipped
+static Hdr_Planes hdr_planes_from_rgb(u32 width, u32 height, f32 *source, f32 *memory)
+{
+    u64 plane_count = align_bin_to((u64)width*height*sizeof(f32), (u64)Image_Alignment) / sizeof(f32);
+    Hdr_Planes result = {};
+    result.memory = memory;
+    result.r = memory;
+    result.g = memory + plane_count;
+    result.b = memory + 2*plane_count;
+    
+    for (u64 y = 0; y < height; y += 1)
+    {
+        f32 *source_row = source + y*width*3;
+        u64 destination_row = (height - y - 1)*width;
+        
+        for (u64 x = 0; x < width; x += 1)
+        {
+            result.r[destination_row + x] = source_row[x*3 + 0];
+            result.g[destination_row + x] = source_row[x*3 + 1];
+            result.b[destination_row + x] = source_row[x*3 + 2];
+        }
+    }
+    
+    return result;
+}
+
+static void hdr_saturate(Hdr_Planes *planes, u32 width, u32 height, f32 saturation)
+{
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    __m256 coef_r = _mm256_set1_ps(0.2126f);
+    __m256 coef_g = _mm256_set1_ps(0.7152f);
+    __m256 coef_b = _mm256_set1_ps(0.0722f);
+    __m256 saturation_wide = _mm256_set1_ps(saturation);
+    
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m256 r = _mm256_loadu_ps(&planes->r[i]);
+        __m256 g = _mm256_loadu_ps(&planes->g[i]);
+        __m256 b = _mm256_loadu_ps(&planes->b[i]);
+        
+        __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+        luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+        
+        _mm256_storeu_ps(&planes->r[i], _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(r, luminance), saturation_wide)));
+        _mm256_storeu_ps(&planes->g[i], _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(g, luminance), saturation_wide)));
+        _mm256_storeu_ps(&planes->b[i], _mm256_add_ps(luminance, _mm256_mul_ps(_mm256_sub_ps(b, luminance), saturation_wide)));
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        v3 source = {planes->r[i], planes->g[i], planes->b[i]};
+        f32 luminance = (source.r * 0.2126f +
+                         source.g * 0.7152f +
+                         source.b * 0.0722f);
+        v3 gray = {luminance, luminance, luminance};
+        v3 out = gray + (source - gray)*saturation;
+        
+        planes->r[i] = out.r;
+        planes->g[i] = out.g;
+        planes->b[i] = out.b;
+    }
+}
+
+static void hdr_flip_vertically(Hdr_Planes *planes, u32 width, u32 height)
+{
+    f32 *plane_list[] = {planes->r, planes->g, planes->b};
+    for (u32 plane_index = 0; plane_index < array_count(plane_list); plane_index += 1)
+    {
+        f32 *plane = plane_list[plane_index];
+        for (u64 y = 0; y < height / 2; y += 1)
+        {
+            f32 *row = plane + y*width;
+            f32 *opposite_row = plane + (height - y - 1)*width;
+            for (u64 x = 0; x < width; x += 1)
+            {
+                f32 temp = row[x];
+                row[x] = opposite_row[x];
+                opposite_row[x] = temp;
+            }
+        }
+    }
+}
+
+// Luminance based Reinhard (color * 1/(1 + luminance)) so hue is kept, then sRGB encode + quantize
+// through the same table as the linear buffer. Writes opaque pixels in gdi format.
+static void image_from_hdr(Hdr_Planes *planes, u32 width, u32 height, f32 exposure, u32 *destination)
+{
+    linear_tables_init();
+    
+    u64 pixel_count = (u64)width*height;
+    u64 i = 0;
+    
+#if Use_Avx
+    __m256 coef_r = _mm256_set1_ps(0.2126f);
+    __m256 coef_g = _mm256_set1_ps(0.7152f);
+    __m256 coef_b = _mm256_set1_ps(0.0722f);
+    __m256 exposure_wide = _mm256_set1_ps(exposure);
+    __m256 value0 = _mm256_set1_ps(0.f);
+    __m256 value1 = _mm256_set1_ps(1.f);
+    __m256 table_scale = _mm256_set1_ps((f32)(Linear_Encode_Table_Size - 1));
+    __m256 value_half = _mm256_set1_ps(0.5f);
+    
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m256 r = _mm256_mul_ps(_mm256_loadu_ps(&planes->r[i]), exposure_wide);
+        __m256 g = _mm256_mul_ps(_mm256_loadu_ps(&planes->g[i]), exposure_wide);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(&planes->b[i]), exposure_wide);
+        
+        __m256 luminance = _mm256_add_ps(_mm256_mul_ps(r, coef_r), _mm256_mul_ps(g, coef_g));
+        luminance = _mm256_add_ps(luminance, _mm256_mul_ps(b, coef_b));
+        __m256 scale = _mm256_div_ps(value1, _mm256_add_ps(value1, _mm256_max_ps(luminance, value0)));
+        
+        r = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(r, scale), value1), value0);
+        g = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(g, scale), value1), value0);
+        b = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(b, scale), value1), value0);
+        
+        s32 r_index[8], g_index[8], b_index[8];
+        _mm256_storeu_si256((__m256i*)r_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(r, table_scale), value_half)));
+        _mm256_storeu_si256((__m256i*)g_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(g, table_scale), value_half)));
+        _mm256_storeu_si256((__m256i*)b_index, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, table_scale), value_half)));
+        
+        for (u32 lane = 0; lane < 8; lane += 1)
+        {
+            destination[i + lane] = (0xFF00'0000 |
+                                     ((u32)srgb_from_linear_table[r_index[lane]] << 16) |
+                                     ((u32)srgb_from_linear_table[g_index[lane]] << 8) |
+                                     (u32)srgb_from_linear_table[b_index[lane]]);
+        }
+    }
+#endif
+    
+    for (; i < pixel_count; i += 1)
+    {
+        v3 color = exposure*v3{planes->r[i], planes->g[i], planes->b[i]};
+        f32 luminance = (color.r * 0.2126f +
+                         color.g * 0.7152f +
+                         color.b * 0.0722f);
+        color *= 1.f / (1.f + pick_bigger(luminance, 0.f));
+        
+        u32 r = srgb_from_linear_table[srgb_encode_table_index(color.r)];
+        u32 g = srgb_from_linear_table[srgb_encode_table_index(color.g)];
+        u32 b = srgb_from_linear_table[srgb_encode_table_index(color.b)];
+        destination[i] = (0xFF00'0000 | (r << 16) | (g << 8) | b);
+    }
+}
+
+
+
+
+
+
+static s32 win32_throw_message(char *message)
+{
+    MSGBOXPARAMSA params = {};
+    params.cbSize = sizeof(params);
+    params.lpszText = message;
+    params.dwStyle = MB_ICONERROR | MB_TASKMODAL;
+    params.dwStyle |= MB_OK;
+    
+    s32 message_res = MessageBoxIndirectA(&params);
+    return message_res;
+}
+
+
+
+
+
+////////////////////////////////
+// Image buffers are recycled through a size classed pool. Reloading the same image (or a batch of
+// same sized images) gets back a buffer whose pages are already committed and faulted in,
+// instead of a fresh multi-megabyte allocation that page faults on every first touch.
+// Size classes have 4 steps per power of two starting at 64 KiB so the worst case waste is 25%.
+// Not thread safe - buffers are acquired and released by the main thread only.
+//
+// Fresh buffers can optionally be backed by large pages (fewer TLB misses when walking
+// a multi-megabyte image) and/or prefaulted in parallel before they are handed out.
+#define Image_Pool_Min_Class_Shift 16
+#define Image_Pool_Class_Count 64
+#define Image_Pool_Max_Free_Per_Class 4
+
+struct Image_Pool_Free_Buffer
+{
+    Image_Pool_Free_Buffer *next;
+};
+
+enum Image_Pool_Flags
+{
+    Image_Pool_Large_Pages = (1 << 0),
+    Image_Pool_Prefault    = (1 << 1),
+};
+
+struct Image_Pool
+{
+    Image_Pool_Free_Buffer *free_lists[Image_Pool_Class_Count];
+    u32 free_counts[Image_Pool_Class_Count];
+    u32 flags;
+    
+    u64 reused_count;
+    u64 allocated_count;
+    u64 large_page_fallback_count; // large pages were requested but the allocation failed
+};
+static Image_Pool image_pool;
+
+static u64 image_pool_class_size(u32 class_index)
+{
+    u64 base = 1ull << (Image_Pool_Min_Class_Shift + class_index / 4);
+    u64 result = base + (base / 4)*(class_index % 4);
+    return result;
+}
+
+static u32 image_pool_class_from_size(u64 size)
+{
+    u32 result = 0;
+    if (size > (1ull << Image_Pool_Min_Class_Shift))
+    {
+        u32 shift = 0;
+        while (((size - 1) >> (shift + 1)) != 0)
+        {
+            shift += 1;
+        }
+        
+        u64 base = 1ull << shift;
+        u64 quarter = base / 4;
+        u64 steps = (size - base + quarter - 1) / quarter; // 1..4
+        result = (shift - Image_Pool_Min_Class_Shift)*4 + (u32)steps;
+    }
+    return result;
+}
+
+static u32 *image_pool_acquire(Image_Pool *pool, u64 size)
+{
+    u32 class_index = image_pool_class_from_size(size);
+    
+    void *result = nullptr;
+    if (class_index < Image_Pool_Class_Count && pool->free_lists[class_index])
+    {
+        Image_Pool_Free_Buffer *buffer = pool->free_lists[class_index];
+        pool->free_lists[class_index] = buffer->next;
+        pool->free_counts[class_index] -= 1;
+        pool->reused_count += 1;
+        result = buffer;
+    }
+    else
+    {
+        // Pages are 4 KiB aligned which covers Image_Alignment; sizes outside of the classes aren't pooled
+        u64 allocation_size = (class_index < Image_Pool_Class_Count ?
+                               image_pool_class_size(class_index) :
+                               align_bin_to(size, (u64)Image_Alignment));
+        
+        if (pool->flags & Image_Pool_Large_Pages)
+        {
+            result = allocate_large_pages(allocation_size);
+            if (!result)
+            {
+                pool->large_page_fallback_count += 1;
+            }
+        }
+        
+        if (!result)
+        {
+            result = VirtualAlloc(nullptr, allocation_size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+            
+            // large pages are already physically backed, only normal pages need this
+            if (result && (pool->flags & Image_Pool_Prefault))
+            {
+                prefault_pages(result, allocation_size);
+            }
+        }
+        
+        pool->allocated_count += 1;
+    }
+    
+    return (u32 *)result;
+}
+
+static void image_pool_release(Image_Pool *pool, void *memory, u64 size)
+{
+    if (memory)
+    {
+        u32 class_index = image_pool_class_from_size(size);
+        if (class_index < Image_Pool_Class_Count &&
+            pool->free_counts[class_index] < Image_Pool_Max_Free_Per_Class)
+        {
+            Image_Pool_Free_Buffer *buffer = (Image_Pool_Free_Buffer *)memory;
+            buffer->next = pool->free_lists[class_index];
+            pool->free_lists[class_index] = buffer;
+            pool->free_counts[class_index] += 1;
+        }
+        else
+        {
+            VirtualFree(memory, 0, MEM_RELEASE);
+        }
+    }
+}
+
+
+// Drops all cached buffers so the next acquires allocate with the new flags
+static void image_pool_set_flags(Image_Pool *pool, u32 flags)
+{
+    for (u32 class_index = 0; class_index < Image_Pool_Class_Count; class_index += 1)
+    {
+        Image_Pool_Free_Buffer *buffer = pool->free_lists[class_index];
+        while (buffer)
+        {
+            Image_Pool_Free_Buffer *next = buffer->next;
+            VirtualFree(buffer, 0, MEM_RELEASE);
+            buffer = next;
+        }
+        
+        pool->free_lists[class_index] = nullptr;
+        pool->free_counts[class_index] = 0;
+    }
+    
+    pool->flags = flags;
+}
+
+
+static void image_pixels_free(u32 *memory, u32 width, u32 height)
+{
+    image_pool_release(&image_pool, memory, (u64)width*height*sizeof(u32));
+}
+
+
+// Has to return memory that is aligned and padded to Image_Alignment (like image_pool_acquire does).
+typedef void *Image_Destination_Allocate(void *user_data, u64 size);
+
+struct Image_Allocator
+{
+    Memory_Arena *temporary; // stb_image.h temporaries; reset at the end of every decode
+    Image_Destination_Allocate *allocate_destination; // final pixels
+    void *user_data;
+};
+
+static void *image_default_destination(void *user_data, u64 size)
+{
+    void *result = image_pool_acquire(&image_pool, size);
+    return result;
+}
+
+static Memory_Arena *image_thread_decode_arena()
+{
+    static thread_local Memory_Arena arena;
+    if (!arena.base)
+    {
+        // only address space - pages get committed as the decoder needs them
+        arena = arena_create(4ull*1024*1024*1024);
+    }
+    return &arena;
+}
+
+static Image_Allocator image_default_allocator()
+{
+    Image_Allocator result = {};
+    result.temporary = image_thread_decode_arena();
+    result.allocate_destination = image_default_destination;
+    return result;
+}
+
+
+struct Loaded_Image
+{
+    u32 *memory; // gdi format (BGRA, bottom-up)
+    u32 width, height;
+    
+    // Full precision copy of 16-bit images in the same layout with u16 per channel.
+    // memory holds its 8-bit version for display.
+    u64 *memory16;
+    
+    // Radiance HDR images are kept as linear float planes; memory holds their tone mapped version.
+    Hdr_Planes hdr;
+    
+    // Opaque 8-bit images as packed BGR (see image_stride_24) when Image_Load_Options.packed_24 asked for it.
+    // The 24-bit version is the one that gets edited and memory is refreshed from it for display.
+    u8 *memory24;
+    
+    // When the pixels come from the pixel cache memory points into this copy-on-write view,
+    // otherwise memory, memory16 and hdr are from the image pool.
+    Mapped_File cache_view;
+    
+    f32 decode_time; // seconds from the mapped file to gdi pixels (or the pixel cache lookup)
+    
+    // The decode already applied the requested saturation (JPEGs with chroma)
+    b32 saturation_applied;
+    
+    // 8-bit image without alpha in the file - the ones that can be packed to 24 bits
+    b32 opaque;
+};
+
+static void image_release(Loaded_Image *image)
+{
+    if (image->cache_view.memory)
+    {
+        unmap_file(&image->cache_view);
+    }
+    else
+    {
+        image_pixels_free(image->memory, image->width, image->height);
+        image_pool_release(&image_pool, image->memory16, (u64)image->width*image->height*sizeof(u64));
+        image_pool_release(&image_pool, image->hdr.memory, hdr_planes_size(image->width, image->height));
+    }
+    // packed from the cache view as well, so always from the pool
+    image_pool_release(&image_pool, image->memory24, (u64)image_stride_24(image->width)*image->height);
+    *image = {};
+}
+
+
+
+
+// stb_image.h format -> gdi format; swaps bytes and flips the image while copying
+static void image_copy_for_gdi(u32 width, u32 height, u32 *source, u32 *destination)
+{
+    image_convert_format(width, height, (u8 *)source, width*4, Pixel_Rgba,
+                         (u8 *)destination, width*4, Pixel_Bgra, true);
+}
+
+// For pixels that are already BGRA (JPEGs decoded with jpeg_ycbcr_to_bgra_row) - only flips
+static void image_copy_flipped(u32 width, u32 height, u32 *source, u32 *destination)
+{
+    for (u64 y = 0; y < height; y += 1)
+    {
+        memcpy(destination + (height - y - 1)*width, source + y*width, width*sizeof(u32));
+    }
+}
+
+static void image_copy_for_gdi_16(u32 width, u32 height, u64 *source, u64 *destination)
+{
+    for (u64 y = 0; y < height; y += 1)
+    {
+        u64 *source_row = source + y*width;
+        u64 *destination_row = destination + (height - y - 1)*width;
+        
+        for (u64 x = 0; x < width; x += 1)
+        {
+            u64 value = source_row[x];
+            destination_row[x] = (((value & 0xFFFF'0000'FFFF'0000)      ) |
+                                  ((value & 0x0000'0000'0000'FFFF) << 32) |
+                                  ((value & 0x0000'FFFF'0000'0000) >> 32));
+        }
+    }
+}
+
+
+struct Image_Load_Options
+{
+    b32 use_pixel_cache;
+    
+    // Applied while decoding where that is free (see Loaded_Image.saturation_applied); 1 for the pixels
+    // as they are in the file. JPEGs get it in YCbCr, raw YUV frames always.
+    f32 saturation;
+    
+    // Also keep opaque 8-bit images as packed BGR (Loaded_Image.memory24)
+    b32 packed_24;
+};
+
+static Image_Load_Options image_default_load_options()
+{
+    Image_Load_Options result = {};
+    result.saturation = 1.f;
+    return result;
+}
+
+
+// Fills out with pixels in gdi format (BGRA, bottom-up) that were allocated with allocator->allocate_destination.
+// 16-bit images are also kept at full precision in out->memory16 and HDR images as float planes in out->hdr.
+// Everything stb_image.h allocates on the way lands in allocator->temporary,
+// so a decode doesn't hit the heap at all once the arena has grown to fit the biggest image.
+static b32 image_decode(Image_Allocator *allocator, u8 *file_memory, u64 file_size, Image_Load_Options *options,
+                        Loaded_Image *out)
+{
+    *out = {};
+    
+    // stbi_load_from_memory takes an int size
+    if (file_memory && file_size <= 0x7FFF'FFFF)
+    {
+        int image_width = 0;
+        int image_height = 0;
+        int components = 0;
+        
+        image_decode_arena_context = allocator->temporary;
+        b32 is_hdr = stbi_is_hdr_from_memory(file_memory, (int)file_size);
+        b32 is_16_bit = !is_hdr && stbi_is_16_bit_from_memory(file_memory, (int)file_size);
+        void *decoded = nullptr;
+        if (is_hdr)
+        {
+            decoded = stbi_loadf_from_memory(file_memory, (int)file_size,
+                                             &image_width, &image_height, &components, 3);
+        }
+        else if (is_16_bit)
+        {
+            decoded = stbi_load_16_from_memory(file_memory, (int)file_size,
+                                               &image_width, &image_height, &components, 4);
+        }
+        else
+        {
+            jpeg_decoded_to_bgra = false;
+            if (options->saturation >= 0.f && options->saturation <= Ycbcr_Max_Saturation)
+            {
+                jpeg_chroma_saturation = options->saturation;
+            }
+            decoded = stbi_load_from_memory(file_memory, (int)file_size,
+                                            &image_width, &image_height, &components, 4);
+            out->saturation_applied = (jpeg_decoded_to_bgra && jpeg_chroma_saturation == options->saturation);
+            jpeg_chroma_saturation = 1.f;
+        }
+        image_decode_arena_context = nullptr;
+        
+        if (decoded)
+        {
+            u32 width = (u32)image_width;
+            u32 height = (u32)image_height;
+            u64 pixel_count = (u64)width*height;
+            
+            out->width = width;
+            out->height = height;
+            out->memory = (u32 *)allocator->allocate_destination(allocator->user_data, pixel_count*sizeof(u32));
+            
+            // full precision copy next to the 8-bit pixels
+            u64 wide_size = 0;
+            if (is_hdr)
+            {
+                wide_size = hdr_planes_size(width, height);
+            }
+            else if (is_16_bit)
+            {
+                wide_size = pixel_count*sizeof(u64);
+            }
+            
+            void *wide_memory = nullptr;
+            if (wide_size)
+            {
+                wide_memory = allocator->allocate_destination(allocator->user_data, wide_size);
+            }
+            
+            if (out->memory && (wide_memory || !wide_size))
+            {
+                if (is_hdr)
+                {
+                    out->hdr = hdr_planes_from_rgb(width, height, (f32 *)decoded, (f32 *)wide_memory);
+                    image_from_hdr(&out->hdr, width, height, 1.f, out->memory);
+                }
+                else if (is_16_bit)
+                {
+                    out->memory16 = (u64 *)wide_memory;
+                    image_copy_for_gdi_16(width, height, (u64 *)decoded, out->memory16);
+                    image_quantize_16_to_8(width, height, out->memory16, out->memory);
+                }
+                else if (jpeg_decoded_to_bgra)
+                {
+                    image_copy_flipped(width, height, (u32 *)decoded, out->memory);
+                }
+                else
+                {
+                    image_copy_for_gdi(width, height, (u32 *)decoded, out->memory);
+                }
+                
+                // stb_image.h reports the channel count of the file - 1 and 3 have no alpha
+                // a JPEG saturated while decoding has no conversion left that the packed pixels could speed up
+                out->opaque = (!is_hdr && !is_16_bit && (components == 1 || components == 3));
+                b32 fully_converted = (out->saturation_applied && options->saturation != 1.f);
+                if (options->packed_24 && out->opaque && !fully_converted)
+                {
+                    out->memory24 = (u8 *)allocator->allocate_destination(allocator->user_data,
+                                                                          (u64)image_stride_24(width)*height);
+                    if (out->memory24)
+                    {
+                        image_pack_24(width, height, out->memory, out->memory24);
+                    }
+                }
+            }
+            else
+            {
+                image_pool_release(&image_pool, wide_memory, wide_size);
+                image_release(out);
+            }
+            
+            if (!allocator->temporary)
+            {
+                image_free(decoded);
+            }
+        }
+        
+        if (allocator->temporary)
+        {
+            arena_reset(allocator->temporary);
+        }
+    }
+    
+    return (out->memory != nullptr);
+}
+
+// Raw NV12/I420 frame -> gdi pixels in a single pass; the saturation is always applied
+static b32 image_decode_yuv(Image_Allocator *allocator, u8 *file_memory, u64 file_size,
+                            Yuv_Format format, u32 width, u32 height, f32 saturation, Loaded_Image *out)
+{
+    *out = {};
+    
+    if (file_memory && file_size >= yuv_frame_size(width, height))
+    {
+        out->memory = (u32 *)allocator->allocate_destination(allocator->user_data, (u64)width*height*sizeof(u32));
+        if (out->memory)
+        {
+            out->width = width;
+            out->height = height;
+            out->saturation_applied = true;
+            
+            Yuv_Frame frame = yuv_frame_from_memory(format, width, height, file_memory);
+            convert_yuv_image(&frame, width, height, pick_bigger(saturation, 0.f), out->memory);
+        }
+    }
+    
+    return (out->memory != nullptr);
+}
+
+////////////////////////////////
+// Pixel cache: decoded pixels (already in gdi format) are stored next to the source file as
+// "<path>.bgra" - a page sized header followed by raw pixels. The header keeps the size and
+// last write time of the source file and the cache is only used when both still match.
+// A cache hit maps the file copy-on-write: loading is a page cache lookup instead of
+// a full inflate, and editing the pixels never writes back to the cache file.
+#define Pixel_Cache_Magic 0x41524742 // "BGRA"
+#define Pixel_Cache_Version 2
+#define Pixel_Cache_Pixel_Offset 4096 // keeps pixels page aligned in the view
+
+struct Pixel_Cache_Header
+{
+    u32 magic;
+    u32 version;
+    u64 source_size;
+    u64 source_write_time;
+    u32 width;
+    u32 height;
+    b32 opaque; // so a hit can be packed to 24 bits like a fresh decode
+};
+
+static b32 pixel_cache_key(char *source_path, u64 *out_size, u64 *out_write_time)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+    b32 result = GetFileAttributesExA(source_path, GetFileExInfoStandard, &attributes);
+    if (result)
+    {
+        *out_size = ((u64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        *out_write_time = (((u64)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+                           attributes.ftLastWriteTime.dwLowDateTime);
+    }
+    return result;
+}
+
+static void pixel_cache_path(char *source_path, char *out, u64 out_size)
+{
+    snprintf(out, out_size, "%s.bgra", source_path);
+}
+
+// Returns an empty Mapped_File if there is no up to date cache for the source
+static Mapped_File pixel_cache_map(char *source_path)
+{
+    Mapped_File result = {};
+    
+    u64 source_size = 0;
+    u64 source_write_time = 0;
+    if (pixel_cache_key(source_path, &source_size, &source_write_time))
+    {
+        char cache_path[MAX_PATH + 16];
+        pixel_cache_path(source_path, cache_path, sizeof(cache_path));
+        
+        result = map_file_copy_on_write(cache_path);
+        if (result.memory)
+        {
+            Pixel_Cache_Header *header = (Pixel_Cache_Header *)result.memory;
+            u64 pixels_size = (u64)header->width*header->height*sizeof(u32);
+            
+            b32 valid = (result.size >= Pixel_Cache_Pixel_Offset &&
+                         header->magic == Pixel_Cache_Magic &&
+                         header->version == Pixel_Cache_Version &&
+                         header->source_size == source_size &&
+                         header->source_write_time == source_write_time &&
+                         result.size >= Pixel_Cache_Pixel_Offset + align_bin_to(pixels_size, (u64)Image_Alignment));
+            if (!valid)
+            {
+                unmap_file(&result);
+            }
+        }
+    }
+    
+    return result;
+}
+
+static void pixel_cache_store(char *source_path, Loaded_Image *image)
+{
+    Pixel_Cache_Header header = {};
+    header.magic = Pixel_Cache_Magic;
+    header.version = Pixel_Cache_Version;
+    header.width = image->width;
+    header.height = image->height;
+    header.opaque = image->opaque;
+    if (!pixel_cache_key(source_path, &header.source_size, &header.source_write_time))
+    {
+        return;
+    }
+    
+    // Written to a temporary file first so a half written cache is never picked up
+    char cache_path[MAX_PATH + 16];
+    char temp_path[MAX_PATH + 32];
+    pixel_cache_path(source_path, cache_path, sizeof(cache_path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+    
+    HANDLE file = CreateFileA(temp_path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        static u8 header_page[Pixel_Cache_Pixel_Offset];
+        memcpy(header_page, &header, sizeof(header));
+        
+        // image buffers are padded to Image_Alignment so the tail is safe to write out
+        u64 pixels_size = align_bin_to((u64)image->width*image->height*sizeof(u32), (u64)Image_Alignment);
+        b32 written = (write_file_all(file, header_page, sizeof(header_page)) &&
+                       write_file_all(file, image->memory, pixels_size));
+        CloseHandle(file);
+        
+        if (!written || !MoveFileExA(temp_path, cache_path, MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileA(temp_path);
+        }
+    }
+}
+
+
+
+
+////////////////////////////////
+// Either the encoded file or its pixel cache, mapped and prefetched
+struct Image_Source
+{
+    Mapped_File file;
+    b32 from_pixel_cache;
+};
+
+static Image_Source image_source_open(char *path, b32 use_pixel_cache)
+{
+    Image_Source result = {};
+    if (use_pixel_cache)
+    {
+        result.file = pixel_cache_map(path);
+        result.from_pixel_cache = (result.file.memory != nullptr);
+    }
+    
+    // Maps the file instead of going through stdio - stb decodes straight from the page cache
+    // so there is no fread copy into stb's internal buffer.
+    if (!result.from_pixel_cache)
+    {
+        result.file = map_file_read_only(path);
+    }
+    
+    prefetch_mapped_file(&result.file);
+    return result;
+}
+
+// Takes ownership of the source
+static b32 image_source_load(Image_Allocator *allocator, char *path, Image_Source *source,
+                             Image_Load_Options *options, Loaded_Image *out)
+{
+    *out = {};
+    s64 start = time_perf();
+    
+    if (source->from_pixel_cache)
+    {
+        Pixel_Cache_Header *header = (Pixel_Cache_Header *)source->file.memory;
+        out->memory = (u32 *)(source->file.memory + Pixel_Cache_Pixel_Offset);
+        out->width = header->width;
+        out->height = header->height;
+        out->opaque = header->opaque;
+        out->cache_view = source->file;
+        
+        // same pixels as image_decode would hand out, so the same kernels run on a hit and on a miss
+        if (options->packed_24 && out->opaque)
+        {
+            out->memory24 = (u8 *)allocator->allocate_destination(allocator->user_data,
+                                                                  (u64)image_stride_24(out->width)*out->height);
+            if (out->memory24)
+            {
+                image_pack_24(out->width, out->height, out->memory, out->memory24);
+            }
+        }
+    }
+    else
+    {
+        Yuv_Format yuv_format;
+        u32 yuv_width, yuv_height;
+        b32 is_yuv = yuv_format_from_path(path, &yuv_format, &yuv_width, &yuv_height);
+        if (is_yuv)
+        {
+            image_decode_yuv(allocator, source->file.memory, source->file.size,
+                             yuv_format, yuv_width, yuv_height, options->saturation, out);
+        }
+        else
+        {
+            image_decode(allocator, source->file.memory, source->file.size, options, out);
+        }
+        unmap_file(&source->file);
+        
+        // the cache only keeps 8-bit pixels as they are in the file - 16-bit and HDR images are always decoded
+        // and raw YUV frames are already a single pass
+        if (out->memory && !out->memory16 && !out->hdr.memory && !is_yuv &&
+            options->saturation == 1.f && options->use_pixel_cache)
+        {
+            pixel_cache_store(path, out);
+        }
+    }
+    
+    out->decode_time = time_elapsed(time_perf(), start);
+    *source = {};
+    return (out->memory != nullptr);
+}
+
+static b32 image_load(Image_Allocator *allocator, char *path, Image_Load_Options *options, Loaded_Image *out)
+{
+    Image_Source source = image_source_open(path, options->use_pixel_cache);
+    b32 result = image_source_load(allocator, path, &source, options, out);
+    return result;
+}
+
+
+// On load failure image->memory is null. The callback owns the image and releases it with image_release.
+typedef void Image_Batch_Callback(char *path, Loaded_Image *image, void *user_data);
+
+static void image_load_batch(Image_Allocator *allocator, char **paths, u32 path_count, Image_Load_Options *options,
+                             Image_Batch_Callback *callback, void *user_data)
+{
+    // The next file is always mapped and prefetched before we start decoding the current one.
+    // PrefetchVirtualMemory is asynchronous so its disk reads overlap with the decode.
+    Image_Source next = {};
+    if (path_count)
+    {
+        next = image_source_open(paths[0], options->use_pixel_cache);
+    }
+    
+    for (u32 i = 0; i < path_count; i += 1)
+    {
+        Image_Source current = next;
+        next = {};
+        
+        if (i + 1 < path_count)
+        {
+            next = image_source_open(paths[i + 1], options->use_pixel_cache);
+        }
+        
+        Loaded_Image image = {};
+        image_source_load(allocator, paths[i], &current, options, &image);
+        callback(paths[i], &image, user_data);
+    }
+}
+
+
+
+
+struct App_State
+{
+    HWND window;
+    Gdi_Buffer buffer; // wraps image.memory
+    Loaded_Image image;
+    Linear_Buffer linear; // built on first use of '7', dropped by every other edit
+    Chroma_Planes chroma; // scrub mode ('S'): the saturation keys re-render from it, dropped by every other key
+    float saturation;
+    char *image_path;
+    b32 use_pixel_cache;
+    b32 packed_24;
+    b32 vibrance; // C and B use the saturation value as vibrance (8-bit 32 bpp images only)
+    b32 linear_light; // C and B saturate in linear light (8-bit 32 bpp images only); excludes vibrance
+    b32 buffer_is_cold; // nothing has touched the buffer since it was loaded
+    b32 large_pages_privilege;
+    
+    Image_Stats stats; // of the output of the last C, 3-6 or 8
+    b32 stats_valid; // cleared by every other key
+    
+    char benchmark_text[512];
+};
+static App_State app_state;
+
+
+static void app_drop_linear_buffer()
+{
+    Linear_Buffer *linear = &app_state.linear;
+    image_pool_release(&image_pool, linear->memory, linear_buffer_size(linear->width, linear->height));
+    *linear = {};
+}
+
+static void app_drop_chroma_planes()
+{
+    Chroma_Planes *chroma = &app_state.chroma;
+    image_pool_release(&image_pool, chroma->memory, chroma_planes_size(chroma->width, chroma->height));
+    *chroma = {};
+}
+
+// The image is loaded into fresh buffers allocated with pool_flags. The pool is flushed after the old image
+// is released, or it would hand the same faulted in buffer back - toggles wouldn't take effect and
+// the first benchmark iteration wouldn't be cold.
+static void reload_default_image(u32 pool_flags)
+{
+    app_drop_linear_buffer();
+    app_drop_chroma_planes();
+    
+    // release first - a mapped cache file can be rewritten
+    image_release(&app_state.image);
+    app_state.buffer = {};
+    image_pool_set_flags(&image_pool, pool_flags);
+    
+    Image_Allocator allocator = image_default_allocator();
+    Image_Load_Options options = image_default_load_options();
+    options.use_pixel_cache = app_state.use_pixel_cache;
+    options.packed_24 = app_state.packed_24;
+    if (!image_load(&allocator, app_state.image_path, &options, &app_state.image))
+    {
+        char message[512];
+        snprintf(message, sizeof(message), "Please put %s into current working directory", app_state.image_path);
+        win32_throw_message(message);
+        ExitProcess(0);
+    }
+    
+    app_state.buffer = create_gdi_buffer(app_state.image.width, app_state.image.height, app_state.image.memory);
+    app_state.buffer_is_cold = true;
+}
+
+
+
+
+// 16-bit and HDR images are edited at full precision and packed 24-bit images as they are;
+// call app_refresh_display afterwards
+// stats (may be null) are gathered for 8-bit 32 bpp images with plain saturation or vibrance
+static void app_convert_image(Image_Stats *stats)
+{
+    Loaded_Image *image = &app_state.image;
+    if (image->hdr.memory)
+    {
+        hdr_saturate(&image->hdr, image->width, image->height, app_state.saturation);
+    }
+    else if (image->memory16)
+    {
+        convert_image_16(image->width, image->height, image->memory16, app_state.saturation);
+    }
+    else if (image->memory24)
+    {
+        convert_image_24(image->width, image->height, image->memory24, app_state.saturation);
+    }
+    else if (app_state.linear_light)
+    {
+        convert_image_linear(image->width, image->height, image->memory, app_state.saturation);
+    }
+    else
+    {
+        u32 ops = Convert_All | (app_state.vibrance ? Convert_Vibrance : 0);
+        convert_image_ops(image->width, image->height, image->memory, ops, app_state.saturation, stats);
+        app_state.stats_valid = (stats != nullptr);
+    }
+}
+
+static void app_refresh_display()
+{
+    Loaded_Image *image = &app_state.image;
+    if (image->hdr.memory)
+    {
+        image_from_hdr(&image->hdr, image->width, image->height, 1.f, image->memory);
+    }
+    else if (image->memory16)
+    {
+        image_quantize_16_to_8(image->width, image->height, image->memory16, image->memory);
+    }
+    else if (image->memory24)
+    {
+        image_unpack_24(image->width, image->height, image->memory24, image->memory);
+    }
+}
+
+// scrub mode: one multiply-add per channel instead of a full convert_image per saturation step
+static void app_scrub()
+{
+    if (app_state.chroma.memory)
+    {
+        // the render replaces the image, so a later '7' has to start from it
+        app_drop_linear_buffer();
+        image_from_chroma_planes(&app_state.chroma, app_state.saturation, app_state.buffer.memory);
+    }
+}
+
+// For operations that only exist for u32 pixels - from then on the u32 version is the image
+static void app_drop_high_precision()
+{
+    Loaded_Image *image = &app_state.image;
+    image_pool_release(&image_pool, image->memory16, (u64)image->width*image->height*sizeof(u64));
+    image_pool_release(&image_pool, image->hdr.memory, hdr_planes_size(image->width, image->height));
+    image_pool_release(&image_pool, image->memory24, (u64)image_stride_24(image->width)*image->height);
+    image->memory16 = nullptr;
+    image->hdr = {};
+    image->memory24 = nullptr;
+}
+
+
+
+
+static LRESULT win32_window_procedure(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    LRESULT result = 0;
+    switch (message)
+    {
+        case WM_QUIT:
+        case WM_CLOSE:
+        {
+            ExitProcess(0);
+        } break;
+        
+        case WM_KEYDOWN:
+        {
+            Gdi_Buffer *buffer = &app_state.buffer;
+            
+            u64 vk_code = wParam;
+            
+            // the linear buffer is only valid as long as '7' is the only thing changing the image
+            if (vk_code == 'C' || vk_code == 'B' || vk_code == 'A' || (vk_code >= '1' && vk_code <= '6') || vk_code == '8')
+            {
+                app_drop_linear_buffer();
+            }
+            
+            app_state.stats_valid = false;
+            
+            // scrub mode lasts until any key other than the saturation ones
+            if (vk_code != 'S' && vk_code != VK_OEM_4 && vk_code != VK_OEM_6 && vk_code != VK_BACK)
+            {
+                app_drop_chroma_planes();
+            }
+            
+            switch (vk_code)
+            {
+                case 'C':
+                {
+                    app_state.stats = {};
+                    app_convert_image(&app_state.stats);
+                    app_refresh_display();
+                    app_state.buffer_is_cold = false;
+                } break;
+                
+                case 'B':
+                {
+                    // simple benchmark
+                    f32 lowest_time = 10000.f;
+                    f32 first_time = 0;
+                    f32 total_time = 0;
+                    int loop_count = 245;
+                    
+                    s64 last = time_perf();
+                    for (int i = 0; i < loop_count; i += 1)
+                    {
+                        app_convert_image(nullptr);
+                        
+                        s64 now = time_perf();
+                        f32 elapsed = time_elapsed(now, last);
+                        last = now;
+                        
+                        if (i == 0) {
+                            first_time = elapsed;
+                        }
+                        
+                        if (elapsed < lowest_time) {
+                            lowest_time = elapsed;
+                        }
+                        
+                        total_time += elapsed;
+                    }
+                    
+                    
+                    f32 average_time = total_time / (f32)loop_count;
+                    app_refresh_display();
+                    
+                    // First iteration right after a reload runs on a cold buffer (press R then B to see it)
+                    char *first_label = (app_state.buffer_is_cold ? "cold" : "warm");
+                    app_state.buffer_is_cold = false;
+                    
+                    snprintf(app_state.benchmark_text, sizeof(app_state.benchmark_text),
+                             "%sFirst (%s): %.3fms\nLowest: %.3fms\nAverage: %.3fms\nTotal: %.3fms\n",
+                             (app_state.image.hdr.memory ? "HDR (saturation only)\n" :
+                              app_state.image.memory16 ? "16-bit\n" : app_state.image.memory24 ? "packed 24-bit\n" :
+                              app_state.vibrance ? "vibrance\n" : app_state.linear_light ? "linear light\n" : ""),
+                             first_label, first_time*1000.f,
+                             lowest_time*1000.f, average_time*1000.f, total_time*1000.f);
+                    OutputDebugStringA(app_state.benchmark_text);
+                } break;
+                
+                case 'R':
+                {
+                    reload_default_image(image_pool.flags);
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'H':
+                {
+                    u32 flags = image_pool.flags ^ Image_Pool_Large_Pages;
+                    if ((flags & Image_Pool_Large_Pages) && !app_state.large_pages_privilege)
+                    {
+                        app_state.large_pages_privilege = enable_large_pages();
+                    }
+                    
+                    reload_default_image(flags);
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'K':
+                {
+                    app_state.use_pixel_cache = !app_state.use_pixel_cache;
+                    reload_default_image(image_pool.flags);
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'O':
+                {
+                    app_state.packed_24 = !app_state.packed_24;
+                    reload_default_image(image_pool.flags);
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'A':
+                {
+                    // auto saturation: the saturation variable is picked from the image, then it converts like C
+                    Auto_Saturation settings = auto_saturation_defaults();
+                    app_state.saturation = image_auto_saturation(buffer->width, buffer->height, buffer->memory, &settings);
+                    app_state.vibrance = false;
+                    app_state.linear_light = false;
+                    app_state.stats = {};
+                    app_convert_image(&app_state.stats);
+                    app_refresh_display();
+                    app_state.buffer_is_cold = false;
+                } break;
+                
+                case 'V':
+                {
+                    app_state.vibrance = !app_state.vibrance;
+                    app_state.linear_light = false;
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'L':
+                {
+                    app_state.linear_light = !app_state.linear_light;
+                    app_state.vibrance = false;
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'P':
+                {
+                    reload_default_image(image_pool.flags ^ Image_Pool_Prefault);
+                    app_state.benchmark_text[0] = 0;
+                } break;
+                
+                case 'S':
+                {
+                    // scrub mode: the saturation keys show convert_image(saturation) of the image as it is now
+                    Loaded_Image *image = &app_state.image;
+                    if (app_state.chroma.memory)
+                    {
+                        app_drop_chroma_planes();
+                    }
+                    else if (!image->hdr.memory && !image->memory16 && !image->memory24)
+                    {
+                        u16 *memory = (u16 *)image_pool_acquire(&image_pool, chroma_planes_size(buffer->width, buffer->height));
+                        if (memory)
+                        {
+                            app_state.chroma = chroma_planes_from_image(buffer->width, buffer->height, buffer->memory, memory);
+                        }
+                    }
+                } break;
+                
+                case VK_OEM_4: // [
+                {
+                    app_state.saturation -= 0.1f;
+                    if (app_state.saturation < 0.f)
+                    {
+                        app_state.saturation = 0.f;
+                    }
+                    app_scrub();
+                } break;
+                
+                case VK_OEM_6: // ]
+                {
+                    app_state.saturation += 0.1f;
+                    app_scrub();
+                } break;
+                
+                case VK_BACK: // backspace
+                {
+                    app_state.saturation = 1.f;
+                    app_scrub();
+                } break;
+                
+                case '1': {
+                    if (app_state.image.hdr.memory) {
+                        Hdr_Planes *hdr = &app_state.image.hdr;
+                        f32 *temp = hdr->r;
+                        hdr->r = hdr->b;
+                        hdr->b = temp;
+                        app_refresh_display();
+                    } else if (app_state.image.memory16) {
+                        image_swap_bytes_between_rgba_and_bgra_16(buffer->width, buffer->height, app_state.image.memory16);
+                        app_refresh_display();
+                    } else if (app_state.image.memory24) {
+                        image_swap_bytes_between_rgb_and_bgr_24(buffer->width, buffer->height, app_state.image.memory24);
+                        app_refresh_display();
+                    } else {
+                        image_swap_bytes_between_rgba_and_bgra(buffer->width, buffer->height, buffer->memory);
+                    }
+                } break;
+                
+                case '2': {
+                    if (app_state.image.hdr.memory) {
+                        hdr_flip_vertically(&app_state.image.hdr, buffer->width, buffer->height);
+                        app_refresh_display();
+                    } else if (app_state.image.memory16) {
+                        image_flip_vertically_16(buffer->width, buffer->height, app_state.image.memory16);
+                        app_refresh_display();
+                    } else if (app_state.image.memory24) {
+                        image_flip_vertically_24(buffer->width, buffer->height, app_state.image.memory24);
+                        app_refresh_display();
+                    } else {
+                        image_flip_vertically(buffer->width, buffer->height, buffer->memory);
+                    }
+                } break;
+                
+                case '3': {
+                    app_drop_high_precision();
+                    app_state.stats = {};
+                    image_saturate(buffer->width, buffer->height, buffer->memory,
+                                   app_state.saturation, Saturation_Hsv, &app_state.stats);
+                    app_state.stats_valid = true;
+                } break;
+                
+                case '4': {
+                    app_drop_high_precision();
+                    app_state.stats = {};
+                    image_saturate(buffer->width, buffer->height, buffer->memory,
+                                   app_state.saturation, Saturation_Hsl, &app_state.stats);
+                    app_state.stats_valid = true;
+                } break;
+                
+                case '5': {
+                    app_drop_high_precision();
+                    app_state.stats = {};
+                    image_saturate(buffer->width, buffer->height, buffer->memory,
+                                   app_state.saturation, Saturation_Luminance_Srgb, &app_state.stats);
+                    app_state.stats_valid = true;
+                } break;
+                
+                case '6': {
+                    app_drop_high_precision();
+                    app_state.stats = {};
+                    image_saturate(buffer->width, buffer->height, buffer->memory,
+                                   app_state.saturation, Saturation_Luminance_Linear, &app_state.stats);
+                    app_state.stats_valid = true;
+                } break;
+                
+                case '7': {
+                    app_drop_high_precision();
+                    
+                    Linear_Buffer *linear = &app_state.linear;
+                    if (!linear->memory)
+                    {
+                        u16 *memory = (u16 *)image_pool_acquire(&image_pool, linear_buffer_size(buffer->width, buffer->height));
+                        if (memory)
+                        {
+                            *linear = linear_buffer_from_image(buffer->width, buffer->height, buffer->memory, memory);
+                        }
+                    }
+                    
+                    if (linear->memory)
+                    {
+                        linear_buffer_saturate(linear, app_state.saturation);
+                        image_from_linear_buffer(linear, buffer->memory);
+                    }
+                } break;
+                
+                case '8': {
+                    app_drop_high_precision();
+                    app_state.stats = {};
+                    image_saturate(buffer->width, buffer->height, buffer->memory,
+                                   app_state.saturation, Saturation_Oklab, &app_state.stats);
+                    app_state.stats_valid = true;
+                } break;
+            }
+        } break;
+        
+        default:
+        {
+            result = DefWindowProcW(window, message, wParam, lParam);
+        } break;
+    }
+    return result;
+}
+
+
+
+
+
+static b32 debug_equals(f32 a, f32 b)
+{
+    f32 epsilon = 0.01f; // for float numerical precision + my test input data wasn't too precise either
+    b32 result = (a - epsilon <= b && a + epsilon >= b);
+    return result;
+}
+
+static b32 debug_equals(v3 a, v3 b)
+{
+    b32 result = (debug_equals(a.x, b.x) &&
+                  debug_equals(a.y, b.y) &&
+                  debug_equals(a.z, b.z));
+    return result;
+}
+
+// xorshift32 - test pixels only need to be all over the place, and the same on every run
+static u32 debug_random(u32 *state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Every channel_bits wide channel of a and b within tolerance - SIMD and scalar float paths may round
+// differently, and -fp:fast lets the compiler reorder the scalar ones
+static b32 debug_channels_close(u64 a, u64 b, u32 channel_bits, u64 tolerance)
+{
+    u64 mask = ((u64)1 << channel_bits) - 1;
+    b32 result = true;
+    for (u32 shift = 0; shift < 64; shift += channel_bits)
+    {
+        u64 channel_a = (a >> shift) & mask;
+        u64 channel_b = (b >> shift) & mask;
+        u64 difference = (channel_a > channel_b ? channel_a - channel_b : channel_b - channel_a);
+        result = (result && difference <= tolerance);
+    }
+    return result;
+}
+
+static void debug_conversion_tests()
+{
+    // I think that tests are useful for this kind of code in general
+    // but besides that - I made some mistakes and needed to find & debug them
+    {
+        Color_Hsl hsl_values[] =
+        {
+            {0,0,0}, {0.5f,0,0}, {0,0.5f,0}, {0,0,0.5f},
+            {0,0.5f,0.5f}, {0.5f,0.5f,0.9f},
+            {0.475f, 0.66f, 0.77f},
+        };
+        v3 rgb_values[] =
+        {
+            {0,0,0}, {0,0,0}, {0,0,0}, {0.5f,0.5f,0.5f},
+            {0.75f,0.25f,0.25f}, {0.8509f,0.94901f,0.94901f},
+            {0.619607f, 0.921568f, 0.874509f},
+        };
+        static_assert(array_count(hsl_values) == array_count(rgb_values), "Expected the same array counts");
+        
+        
+        for (u64 i = 0; i < array_count(hsl_values); i += 1)
+        {
+            v3 result = rgb_from_hsl(hsl_values[i]);
+            assert(debug_equals(result, rgb_values[i]));
+        }
+        
+        for (u64 i = 0; i < array_count(hsl_values); i += 1)
+        {
+            Color_Hsl expected = hsl_values[i];
+            
+            Color_Hsl result = hsl_from_rgb(rgb_values[i]);
+            assert(debug_equals(result.vec, expected.vec) ||
+                   (expected.l == 0.f && result.l == 0.f));
+        }
+    }
+    
+    
+    {
+        Color_Hsv hsv_values[] =
+        {
+            {0,0,0}, {0.5f,0,0}, {0,0.5f,0}, {0,0,0.5f},
+            {0,0.5f,0.5f}, {0.5f,0.5f,0.9f},
+            {0.475f, 0.66f, 0.77f},
+        };
+        v3 rgb_values[] =
+        {
+            {0,0,0}, {0,0,0}, {0,0,0}, {0.5f,0.5f,0.5f},
+            {0.5f,0.25f,0.25f}, {0.45098f,0.90196f,0.90196f},
+            {0.262745f, 0.768627f, 0.694118f},
+        };
+        static_assert(array_count(hsv_values) == array_count(rgb_values), "Expected the same array counts");
+        
+        
+        for (u64 i = 0; i < array_count(hsv_values); i += 1)
+        {
+            v3 result = rgb_from_hsv(hsv_values[i]);
+            assert(debug_equals(result, rgb_values[i]));
+        }
+        
+        for (u64 i = 0; i < array_count(hsv_values); i += 1)
+        {
+            Color_Hsv expected = hsv_values[i];
+            
+            Color_Hsv result = hsv_from_rgb(rgb_values[i]);
+            assert(debug_equals(result.vec, expected.vec) ||
+                   (expected.v == 0.f && result.v == 0.f));
+        }
+    }
+    
+    
+    {
+        // convert_image_16 (SIMD rows + convert_pixel_16 tails) against convert_pixel_16 alone
+        u32 random = 0x1234'5678;
+        u32 sizes[][2] = {{13, 5}, {8, 4}, {3, 3}};
+        f32 saturations[] = {0.3f, 1.7f};
+        
+        for (u64 i = 0; i < array_count(sizes); i += 1)
+        {
+            for (u64 j = 0; j < array_count(saturations); j += 1)
+            {
+                u32 width = sizes[i][0];
+                u32 height = sizes[i][1];
+                u64 source[13*5];
+                u64 image[13*5];
+                for (u64 k = 0; k < (u64)width*height; k += 1)
+                {
+                    source[k] = ((u64)debug_random(&random) << 32) | debug_random(&random);
+                    image[k] = source[k];
+                }
+                
+                convert_image_16(width, height, image, saturations[j]);
+                for (u64 y = 0; y < height; y += 1)
+                {
+                    for (u64 x = 0; x < width; x += 1)
+                    {
+                        u64 expected = convert_pixel_16(source[(height - y - 1)*width + x], saturations[j]);
+                        assert(debug_channels_close(image[y*width + x], expected, 16, 1));
+                    }
+                }
+            }
+        }
+    }
+    
+    
+    {
+        // jpeg_ycbcr_to_bgra_row: 8 pixels at a time against one pixel at a time (the scalar tail), bit exact
+        u32 random = 0x0BAD'F00D;
+        u8 y[37], cb[37], cr[37];
+        for (u64 i = 0; i < array_count(y); i += 1)
+        {
+            y[i] = (u8)debug_random(&random);
+            cb[i] = (u8)debug_random(&random);
+            cr[i] = (u8)debug_random(&random);
+        }
+        
+        f32 saturations[] = {1.f, 0.f, 2.5f};
+        for (u64 j = 0; j < array_count(saturations); j += 1)
+        {
+            jpeg_chroma_saturation = saturations[j];
+            u32 row[37];
+            jpeg_ycbcr_to_bgra_row((u8 *)row, y, cb, cr, (int)array_count(y), 4);
+            for (u64 i = 0; i < array_count(y); i += 1)
+            {
+                u32 expected;
+                jpeg_ycbcr_to_bgra_row((u8 *)&expected, y + i, cb + i, cr + i, 1, 4);
+                assert(row[i] == expected);
+            }
+        }
+        jpeg_chroma_saturation = 1.f;
+        jpeg_decoded_to_bgra = false;
+    }
+    
+    
+    {
+        // convert_yuv_image (row pairs 4 pixels at a time + tails) against yuv_to_bgra_pixel, odd sizes included
+        u32 random = 0xC0FF'EE00;
+        u32 sizes[][2] = {{13, 7}, {8, 4}, {5, 1}};
+        Yuv_Format formats[] = {Yuv_Nv12, Yuv_I420};
+        
+        for (u64 i = 0; i < array_count(sizes); i += 1)
+        {
+            for (u64 j = 0; j < array_count(formats); j += 1)
+            {
+                u32 width = sizes[i][0];
+                u32 height = sizes[i][1];
+                u8 memory[13*7 + 2*7*4];
+                for (u64 k = 0; k < yuv_frame_size(width, height); k += 1)
+                {
+                    memory[k] = (u8)debug_random(&random);
+                }
+                
+                f32 saturation = (j ? 1.6f : 1.f);
+                Yuv_Constants constants = yuv_constants(saturation);
+                Yuv_Frame frame = yuv_frame_from_memory(formats[j], width, height, memory);
+                u32 image[13*7];
+                convert_yuv_image(&frame, width, height, saturation, image);
+                
+                for (u64 y = 0; y < height; y += 1)
+                {
+                    for (u64 x = 0; x < width; x += 1)
+                    {
+                        u64 chroma = (y / 2)*frame.chroma_stride + (x / 2)*frame.chroma_step;
+                        u32 expected = yuv_to_bgra_pixel(frame.y[y*width + x], frame.u[chroma], frame.v[chroma], &constants);
+                        assert(debug_channels_close(image[(height - y - 1)*width + x], expected, 8, 1));
+                    }
+                }
+            }
+        }
+    }
+    
+    
+    {
+        // lut_3d_apply: an identity LUT gives back the (flipped) input exactly, and a random LUT with a
+        // narrower domain (coordinates clamped to the lattice) matches lut_3d_pixel
+        u32 random = 0x5EED'1234;
+        u32 width = 13;
+        u32 height = 5;
+        u32 source[13*5];
+        for (u64 i = 0; i < array_count(source); i += 1)
+        {
+            source[i] = debug_random(&random);
+        }
+        
+        for (u32 identity = 0; identity < 2; identity += 1)
+        {
+            Lut_3d lut = {};
+            lut.size = (identity ? 5 : 3);
+            for (u32 i = 0; i < 3; i += 1)
+            {
+                lut.domain_min[i] = (identity ? 0.f : 0.1f);
+                lut.domain_max[i] = (identity ? 1.f : 0.9f);
+            }
+            lut.entries = (f32 *)_aligned_malloc((u64)lut.size*lut.size*lut.size*4*sizeof(f32), 16);
+            
+            // r index changes fastest, entries are {b, g, r, 0} like lut_3d_load makes them
+            f32 step = 255.f / (f32)(lut.size - 1);
+            for (u32 b = 0; b < lut.size; b += 1)
+            {
+                for (u32 g = 0; g < lut.size; g += 1)
+                {
+                    for (u32 r = 0; r < lut.size; r += 1)
+                    {
+                        f32 *entry = lut.entries + ((b*lut.size + g)*lut.size + r)*4;
+                        entry[0] = (identity ? (f32)b*step : (f32)(debug_random(&random) % 320) - 30.f);
+                        entry[1] = (identity ? (f32)g*step : (f32)(debug_random(&random) % 320) - 30.f);
+                        entry[2] = (identity ? (f32)r*step : (f32)(debug_random(&random) % 320) - 30.f);
+                        entry[3] = 0.f;
+                    }
+                }
+            }
+            
+            u32 image[13*5];
+            memcpy(image, source, sizeof(image));
+            lut_3d_apply(width, height, image, &lut, identity);
+            
+            Lut_3d_Scale scale = lut_3d_scale(&lut);
+            for (u64 y = 0; y < height; y += 1)
+            {
+                for (u64 x = 0; x < width; x += 1)
+                {
+                    u32 result = image[(identity ? height - y - 1 : y)*width + x];
+                    u32 original = source[y*width + x];
+                    if (identity) assert(result == original);
+                    else          assert(debug_channels_close(result, lut_3d_pixel(original, &lut, &scale), 8, 1));
+                }
+            }
+            lut_3d_free(&lut);
+        }
+    }
+    
+    
+    {
+        // image_saturate_oklab: 8 pixels at a time (cbrt_8, matrices in SIMD) against single pixels,
+        // which only run the scalar tail (cbrtf)
+        u32 random = 0x0CAB'0CAB;
+        u32 source[37];
+        for (u64 i = 0; i < array_count(source); i += 1)
+        {
+            source[i] = debug_random(&random);
+        }
+        
+        f32 saturations[] = {0.f, 0.6f, 1.8f};
+        for (u64 j = 0; j < array_count(saturations); j += 1)
+        {
+            u32 image[37];
+            memcpy(image, source, sizeof(image));
+            image_saturate_oklab((u32)array_count(image), 1, image, saturations[j], nullptr);
+            for (u64 i = 0; i < array_count(image); i += 1)
+            {
+                u32 expected = source[i];
+                image_saturate_oklab(1, 1, &expected, saturations[j], nullptr);
+                assert(debug_channels_close(image[i], expected, 8, 1));
+            }
+        }
+    }
+    
+    
+    {
+        // image_convert_format (pshufb tables + tails) against pixel_read_channels/pixel_write_channels for every
+        // format pair, flipped or not, with padded rows that have to stay untouched; the same size pairs in place too
+        u32 random = 0xF0F0'1234;
+        u32 widths[] = {3, 6, 13};
+        u32 heights[] = {1, 4, 5};
+        
+        for (u32 from_format = 0; from_format < Pixel_Format_Count; from_format += 1)
+        {
+            for (u32 to_format = 0; to_format < Pixel_Gray; to_format += 1)
+            {
+                Pixel_Layout from = pixel_layout((Pixel_Format)from_format);
+                Pixel_Layout to = pixel_layout((Pixel_Format)to_format);
+                
+                for (u64 i = 0; i < array_count(widths)*array_count(heights)*2; i += 1)
+                {
+                    u32 width = widths[i % array_count(widths)];
+                    u32 height = heights[(i / array_count(widths)) % array_count(heights)];
+                    b32 flip = (i >= array_count(widths)*array_count(heights));
+                    u32 source_stride = width*from.bytes + 2;
+                    u32 destination_stride = width*to.bytes + 3;
+                    
+                    u8 source[16*4*5];
+                    u8 destination[16*4*5];
+                    u8 expected[16*4*5];
+                    for (u64 k = 0; k < sizeof(source); k += 1)
+                    {
+                        source[k] = (u8)debug_random(&random);
+                        destination[k] = 0xCD;
+                        expected[k] = 0xCD;
+                    }
+                    
+                    for (u64 y = 0; y < height; y += 1)
+                    {
+                        for (u64 x = 0; x < width; x += 1)
+                        {
+                            u8 channels[4];
+                            pixel_read_channels(source + y*source_stride + x*from.bytes, &from, channels);
+                            pixel_write_channels(expected + (flip ? height - y - 1 : y)*destination_stride + x*to.bytes, &to, channels);
+                        }
+                    }
+                    
+                    image_convert_format(width, height, source, source_stride, (Pixel_Format)from_format,
+                                         destination, destination_stride, (Pixel_Format)to_format, flip);
+                    assert(memcmp(destination, expected, sizeof(expected)) == 0);
+                    
+                    if (from.bytes == to.bytes)
+                    {
+                        // in place the rows keep the source stride and the padding keeps the source bytes
+                        u8 memory[16*4*5];
+                        u8 expected_in_place[16*4*5];
+                        memcpy(memory, source, sizeof(source));
+                        memcpy(expected_in_place, source, sizeof(source));
+                        for (u64 y = 0; y < height; y += 1)
+                        {
+                            memcpy(expected_in_place + y*source_stride, expected + y*destination_stride, width*to.bytes);
+                        }
+                        
+                        image_convert_format(width, height, memory, source_stride, (Pixel_Format)from_format,
+                                             memory, source_stride, (Pixel_Format)to_format, flip);
+                        assert(memcmp(memory, expected_in_place, sizeof(memory)) == 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+
+
+struct Batch_State
+{
+    f32 saturation;
+    b32 gray_plane; // -gray: only an 8-bit luminance plane per image, written next to it (thumbnail jobs)
+    b32 vibrance; // -vibrance: saturation is used as vibrance
+    b32 linear_light; // -linear: saturation in linear light
+    u32 sweep_count; // -sweep: contact sheet of that many renders at saturations 0 - 2 from one luminance/chroma decomposition
+    b32 gather_stats; // -stats: Image_Stats of every output from the conversion pass
+    b32 auto_saturation; // -auto, -auto-chroma, -auto-clip: the saturation is picked per image
+    Auto_Saturation auto_settings;
+    Image_Stats total_stats;
+    b32 use_color_matrix; // any of -hue, -brightness, -contrast, -white-balance, -lut
+    Color_Matrix color_matrix;
+    b32 plain_saturation; // none of the modes above, so the decoder can apply the saturation
+    Lut_3d lut; // -lut: the color matrix is baked into it
+    u32 converted_count;
+    u32 failed_count;
+    f32 decode_time;
+    f32 convert_time;
+};
+
+// Binary PGM at <image path>.gray.pgm; the plane rows are top-down like PGM wants
+static b32 batch_write_gray_plane(char *image_path, u32 width, u32 height, u8 *plane)
+{
+    char path[MAX_PATH + 16];
+    snprintf(path, sizeof(path), "%s.gray.pgm", image_path);
+    
+    b32 result = false;
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        char header[64];
+        int header_length = snprintf(header, sizeof(header), "P5\n%u %u\n255\n", width, height);
+        result = (write_file_all(file, header, (u64)header_length) &&
+                  write_file_all(file, plane, (u64)width*height));
+        CloseHandle(file);
+        
+        if (!result)
+        {
+            DeleteFileA(path);
+        }
+    }
+    return result;
+}
+
+// Contact sheet at <image path>.sweep.ppm: the renders at saturations 0 - 2 stacked top to bottom.
+// The renders come out like convert_image (rows top-down, red in the low byte), so every one is packed
+// to RGB and written as soon as it is done - output and rgb are scratch for one render.
+static b32 batch_write_sweep(char *image_path, u32 width, u32 height, Chroma_Planes *planes, u32 sweep_count,
+                             u32 *output, u8 *rgb)
+{
+    char path[MAX_PATH + 16];
+    snprintf(path, sizeof(path), "%s.sweep.ppm", image_path);
+    
+    b32 result = false;
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        char header[64];
+        int header_length = snprintf(header, sizeof(header), "P6\n%u %llu\n255\n", width, (u64)height*sweep_count);
+        result = write_file_all(file, header, (u64)header_length);
+        
+        for (u32 i = 0; result && i < sweep_count; i += 1)
+        {
+            f32 saturation = (sweep_count > 1 ? 2.f*(f32)i/(f32)(sweep_count - 1) : 1.f);
+            image_from_chroma_planes(planes, saturation, output);
+            image_convert_format(width, height, (u8 *)output, width*4, Pixel_Rgba, rgb, width*3, Pixel_Rgb, false);
+            result = write_file_all(file, rgb, (u64)width*3*height);
+        }
+        CloseHandle(file);
+        
+        if (!result)
+        {
+            DeleteFileA(path);
+        }
+    }
+    return result;
+}
+
+static void batch_convert_image(char *path, Loaded_Image *image, void *user_data)
+{
+    Batch_State *batch = (Batch_State *)user_data;
+    
+    if (!image->memory)
+    {
+        printf("%s: failed to load\n", path);
+        batch->failed_count += 1;
+        return;
+    }
+    
+    Image_Stats stats = {};
+    Image_Stats *image_stats = (batch->gather_stats ? &stats : nullptr);
+    
+    // at saturation 1 the decode changed nothing and an opaque JPEG keeps the packed pixels -packed asked for
+    b32 saturated_while_decoding = (image->saturation_applied && batch->plain_saturation && !image->memory24);
+    
+    s64 start = time_perf();
+    f32 saturation = batch->saturation;
+    if (batch->auto_saturation)
+    {
+        // from the 8-bit pixels, which every image has
+        saturation = image_auto_saturation(image->width, image->height, image->memory, &batch->auto_settings);
+    }
+    
+    if (batch->gray_plane)
+    {
+        // from the 8-bit version of every image
+        u64 plane_size = (u64)image->width*image->height;
+        u8 *plane = (u8 *)image_pool_acquire(&image_pool, plane_size);
+        if (plane)
+        {
+            image_luminance_plane(image->width, image->height, image->memory, plane);
+            if (!batch_write_gray_plane(path, image->width, image->height, plane))
+            {
+                printf("%s: failed to write the gray plane\n", path);
+            }
+            image_pool_release(&image_pool, plane, plane_size);
+        }
+    }
+    else if (batch->sweep_count)
+    {
+        // contact sheet: one decomposition, then every render goes through the same scratch buffers to the file
+        u64 planes_size = chroma_planes_size(image->width, image->height);
+        u64 output_size = (u64)image->width*image->height*sizeof(u32);
+        u64 rgb_size = (u64)image->width*3*image->height;
+        u16 *planes_memory = (u16 *)image_pool_acquire(&image_pool, planes_size);
+        u32 *output = image_pool_acquire(&image_pool, output_size);
+        u8 *rgb = (u8 *)image_pool_acquire(&image_pool, rgb_size);
+        if (planes_memory && output && rgb)
+        {
+            Chroma_Planes planes = chroma_planes_from_image(image->width, image->height, image->memory, planes_memory);
+            if (!batch_write_sweep(path, image->width, image->height, &planes, batch->sweep_count, output, rgb))
+            {
+                printf("%s: failed to write the saturation sweep\n", path);
+            }
+        }
+        image_pool_release(&image_pool, planes_memory, planes_size);
+        image_pool_release(&image_pool, output, output_size);
+        image_pool_release(&image_pool, rgb, rgb_size);
+    }
+    else if (batch->vibrance)
+    {
+        convert_image_ops(image->width, image->height, image->memory, Convert_All | Convert_Vibrance,
+                          saturation, image_stats);
+    }
+    else if (batch->linear_light)
+    {
+        convert_image_linear(image->width, image->height, image->memory, saturation);
+    }
+    else if (batch->use_color_matrix)
+    {
+        // the whole grade + swap + flip in one pass over the 8-bit pixels
+        if (batch->lut.entries)
+        {
+            lut_3d_apply(image->width, image->height, image->memory, &batch->lut, true);
+        }
+        else
+        {
+            color_matrix_apply(image->width, image->height, image->memory, &batch->color_matrix, true);
+        }
+    }
+    else if (image->hdr.memory)
+    {
+        hdr_saturate(&image->hdr, image->width, image->height, saturation);
+        image_from_hdr(&image->hdr, image->width, image->height, 1.f, image->memory);
+    }
+    else if (image->memory16)
+    {
+        convert_image_16(image->width, image->height, image->memory16, saturation);
+    }
+    else if (saturated_while_decoding)
+    {
+        // only the swap and the flip are left, so the output has the same layout as every other image
+        convert_image_ops(image->width, image->height, image->memory, Convert_Swap | Convert_Flip, 1.f, nullptr);
+    }
+    else if (image->memory24)
+    {
+        convert_image_24(image->width, image->height, image->memory24, saturation);
+    }
+    else
+    {
+        convert_image_stats(image->width, image->height, image->memory, saturation, image_stats);
+    }
+    f32 elapsed = time_elapsed(time_perf(), start);
+    
+    batch->converted_count += 1;
+    batch->decode_time += image->decode_time;
+    batch->convert_time += elapsed;
+    char *mode = (batch->gray_plane ? " gray plane" : batch->sweep_count ? " saturation sweep" : batch->vibrance ? " vibrance" : batch->linear_light ? " linear light" : batch->lut.entries ? " 3D LUT" : batch->use_color_matrix ? " color matrix" :
+                  image->hdr.memory ? " HDR" : image->memory16 ? " 16-bit" : image->memory24 ? " packed 24-bit" : "");
+    printf("%s: %ux%u%s%s decoded in %.3fms, converted in %.3fms\n", path, image->width, image->height, mode,
+           (image->cache_view.memory ? " (pixel cache)" : saturated_while_decoding ? " (saturated while decoding)" : ""),
+           image->decode_time*1000.f, elapsed*1000.f);
+    
+    if (batch->auto_saturation)
+    {
+        printf("  auto saturation %.2f\n", saturation);
+    }
+    if (stats.pixel_count)
+    {
+        printf("  luminance mean %.1f, 1%% %u, median %u, 99%% %u; chroma mean %.1f; clipped %llu (%.2f%%)\n",
+               image_stats_mean_luminance(&stats), image_stats_luminance_percentile(&stats, 0.01f),
+               image_stats_luminance_percentile(&stats, 0.5f), image_stats_luminance_percentile(&stats, 0.99f),
+               image_stats_mean_chroma(&stats), stats.clipped_count,
+               100.f*(f32)stats.clipped_count/(f32)stats.pixel_count);
+        image_stats_merge(&batch->total_stats, &stats);
+    }
+    else if (batch->gather_stats)
+    {
+        // only the 8-bit saturation and vibrance kernels gather stats
+        printf("  -stats is not supported for the%s path\n", mode);
+    }
+    
+    image_release(image);
+}
+
+// task1.exe -batch [-saturation value] [-vibrance value] [-linear] [-cache] [-packed] [-gray] [-sweep count] [-stats]
+//                  [-auto] [-auto-chroma value] [-auto-clip fraction]
+//                  [-hue degrees] [-brightness value] [-contrast value] [-white-balance r g b] [-lut file.cube] paths...
+// Results are printed to stdout - redirect it to a file because this is a GUI subsystem program.
+static int run_batch(int arg_count, char **args)
+{
+    Batch_State batch = {};
+    batch.saturation = 1.f;
+    batch.auto_settings = auto_saturation_defaults();
+    Image_Load_Options options = image_default_load_options();
+    f32 hue = 0.f;
+    f32 brightness = 0.f;
+    f32 contrast = 1.f;
+    f32 white_balance[3] = {1.f, 1.f, 1.f};
+    char *lut_path = nullptr;
+    
+    for (;;)
+    {
+        if (arg_count >= 2 && strcmp(args[0], "-saturation") == 0)
+        {
+            batch.saturation = (f32)atof(args[1]);
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-vibrance") == 0)
+        {
+            batch.saturation = (f32)atof(args[1]);
+            batch.vibrance = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-sweep") == 0)
+        {
+            char *end = nullptr;
+            long count = strtol(args[1], &end, 10);
+            if (end == args[1] || *end || count <= 0 || count > 0x7FFF'FFFF)
+            {
+                printf("usage: task1.exe -batch -sweep count paths... - count has to be a positive number, not \"%s\"\n", args[1]);
+                fflush(stdout);
+                return 1;
+            }
+            batch.sweep_count = (u32)count;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 1 && strcmp(args[0], "-auto") == 0)
+        {
+            batch.auto_saturation = true;
+            arg_count -= 1;
+            args += 1;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-auto-chroma") == 0)
+        {
+            batch.auto_settings.target_chroma = (f32)atof(args[1]);
+            batch.auto_saturation = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-auto-clip") == 0)
+        {
+            batch.auto_settings.clip_budget = (f32)atof(args[1]);
+            batch.auto_saturation = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 1 && strcmp(args[0], "-stats") == 0)
+        {
+            batch.gather_stats = true;
+            arg_count -= 1;
+            args += 1;
+        }
+        else if (arg_count >= 1 && strcmp(args[0], "-linear") == 0)
+        {
+            batch.linear_light = true;
+            arg_count -= 1;
+            args += 1;
+        }
+        else if (arg_count >= 1 && strcmp(args[0], "-cache") == 0)
+        {
+            options.use_pixel_cache = true;
+            arg_count -= 1;
+            args += 1;
+        }
+        else if (arg_count >= 1 && strcmp(args[0], "-packed") == 0)
+        {
+            options.packed_24 = true;
+            arg_count -= 1;
+            args += 1;
+        }
+        else if (arg_count >= 1 && strcmp(args[0], "-gray") == 0)
+        {
+            batch.gray_plane = true;
+            arg_count -= 1;
+            args += 1;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-hue") == 0)
+        {
+            hue = (f32)atof(args[1]);
+            batch.use_color_matrix = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-brightness") == 0)
+        {
+            brightness = (f32)atof(args[1]);
+            batch.use_color_matrix = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-contrast") == 0)
+        {
+            contrast = (f32)atof(args[1]);
+            batch.use_color_matrix = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else if (arg_count >= 4 && strcmp(args[0], "-white-balance") == 0)
+        {
+            for (u32 i = 0; i < 3; i += 1)
+            {
+                white_balance[i] = (f32)atof(args[1 + i]);
+            }
+            batch.use_color_matrix = true;
+            arg_count -= 4;
+            args += 4;
+        }
+        else if (arg_count >= 2 && strcmp(args[0], "-lut") == 0)
+        {
+            lut_path = args[1];
+            batch.use_color_matrix = true;
+            arg_count -= 2;
+            args += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+    
+    if (batch.auto_saturation && (batch.gray_plane || batch.sweep_count || batch.use_color_matrix))
+    {
+        // the gray plane and the sweep have no saturation to pick, the matrix and the LUT are built once for all images
+        printf("usage: task1.exe -batch -auto paths... - -auto can not be combined with -gray, -sweep, the color adjustments or -lut\n");
+        fflush(stdout);
+        return 1;
+    }
+    
+    if (batch.use_color_matrix)
+    {
+        // white balance -> saturation -> hue -> contrast -> brightness -> R/B swap
+        Color_Matrix stages[] = {
+            color_matrix_white_balance(white_balance[0], white_balance[1], white_balance[2]),
+            color_matrix_saturation(batch.saturation),
+            color_matrix_hue(hue),
+            color_matrix_contrast(contrast),
+            color_matrix_brightness(brightness),
+            color_matrix_swap_rb(),
+        };
+        batch.color_matrix = color_matrix_identity();
+        for (u32 i = 0; i < array_count(stages); i += 1)
+        {
+            batch.color_matrix = color_matrix_multiply(&stages[i], &batch.color_matrix);
+        }
+        
+        // the LUT grade comes first, the adjustments and the swap are applied to its output
+        if (lut_path)
+        {
+            if (!lut_3d_load(lut_path, &batch.lut))
+            {
+                printf("%s: failed to load the 3D LUT\n", lut_path);
+                fflush(stdout);
+                return 1;
+            }
+            lut_3d_bake_matrix(&batch.lut, &batch.color_matrix);
+        }
+        
+        // the matrix works on the 8-bit pixels
+        options.packed_24 = false;
+    }
+    
+    Image_Allocator allocator = image_default_allocator();
+    
+    s64 start = time_perf();
+    batch.plain_saturation = !(batch.gray_plane || batch.sweep_count || batch.vibrance || batch.linear_light ||
+                               batch.use_color_matrix || batch.gather_stats || batch.auto_saturation);
+    if (batch.sweep_count || batch.vibrance || batch.linear_light || batch.gather_stats)
     {
-        stbi_image_free(app_state.buffer.memory);
-        app_state.buffer.memory = nullptr;
+        // 8-bit 32 bpp pixels only
+        options.packed_24 = false;
     }
+    options.saturation = (batch.plain_saturation ? batch.saturation : 1.f);
+    image_load_batch(&allocator, args, (u32)arg_count, &options, batch_convert_image, &batch);
+    f32 total_time = time_elapsed(time_perf(), start);
     
+    printf("Converted: %u, failed: %u\nDecode time: %.3fms\nConvert time: %.3fms\nTotal time: %.3fms\n"
+           "Buffers reused: %llu, allocated: %llu\n",
+           batch.converted_count, batch.failed_count,
+           batch.decode_time*1000.f, batch.convert_time*1000.f, total_time*1000.f,
+           image_pool.reused_count, image_pool.allocated_count);
     
-    char *image_path = "image.png";
-    int image_width = 0;
-    int image_height = 0;
-    int components = 0;
-    
-    u32 *image_data = (u32*)stbi_load(image_path, &image_width, &image_height, &components, 4);
-    if (!image_data)
+    Image_Stats *total = &batch.total_stats;
+    if (total->pixel_count)
     {
-        win32_throw_message("Please put image.png into current working directory");
-        ExitProcess(0);
+        printf("All images: luminance mean %.1f, median %u; chroma mean %.1f; clipped %llu of %llu pixels (%.2f%%)\n",
+               image_stats_mean_luminance(total), image_stats_luminance_percentile(total, 0.5f),
+               image_stats_mean_chroma(total), total->clipped_count, total->pixel_count,
+               100.f*(f32)total->clipped_count/(f32)total->pixel_count);
     }
+    fflush(stdout);
     
-    app_state.buffer = create_gdi_buffer(image_width, image_height, image_data);
-    
-    // stb_image.h format -> gdi format
-    image_swap_bytes_between_rgba_and_bgra(image_width, image_height, image_data);
-    image_flip_vertically(image_width, image_height, image_data);
+    lut_3d_free(&batch.lut);
+    return (batch.failed_count ? 1 : 0);
 }
 
 
 
 
-static LRESULT win32_window_procedure(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
+////////////////////////////////
+// Stream mode for shell video pipelines: frames come in on stdin, get the saturation and flip of convert_image
+// (or go through convert_yuv_image for y4m) and go out on stdout as raw BGRA either way.
+// Reading, converting and writing run on three threads that pass a ring of frame buffers around,
+// so while one frame converts the next one is being read and the previous one written.
+// Frames are read straight into the ring and written straight from it (converted in place for BGRA input) -
+// Windows has no splice/vmsplice, so that is as few copies as the pipes allow.
+#define Stream_Slot_Count 3
+#define Stream_Max_Header_Length 256
+
+struct Stream_Slot
 {
-    LRESULT result = 0;
-    switch (message)
+    u8 *input;   // the frame as read from stdin
+    u32 *pixels; // the frame for stdout; same memory as input for BGRA streams
+    b32 end;     // no frame here - end of input, a read error or the writer gave up
+};
+
+struct Stream_State
+{
+    HANDLE input, output;
+    b32 is_y4m; // 4:2:0 YUV4MPEG2 input, otherwise raw BGRA frames
+    u32 width, height;
+    u64 input_frame_size;
+    u64 output_frame_size;
+    f32 saturation;
+    b32 premultiplied; // raw BGRA frames with premultiplied alpha
+    
+    Stream_Slot slots[Stream_Slot_Count];
+    
+    // Counting semaphores, one per stage - every stage walks the slots in the same order
+    HANDLE free_slots;
+    HANDLE read_slots;
+    HANDLE converted_slots;
+    
+    b32 volatile write_failed; // stdout was closed; the reader stops at the next frame
+    
+    u32 frame_count;
+    f32 convert_time;
+};
+
+// Reads one '\n' terminated line (without the '\n'); false at end of input or when it doesn't fit
+static b32 stream_read_line(HANDLE input, char *line, u32 line_size)
+{
+    for (u32 length = 0; length + 1 < line_size; length += 1)
     {
-        case WM_QUIT:
-        case WM_CLOSE:
-        {
-            ExitProcess(0);
-        } break;
-        
-        case WM_KEYDOWN:
+        if (read_file_all(input, line + length, 1) != 1)
         {
-            Gdi_Buffer *buffer = &app_state.buffer;
-            
-            u64 vk_code = wParam;
-            switch (vk_code)
-            {
-                case 'C':
-                {
-                    convert_image(buffer->width, buffer->height, buffer->memory,
-                                  app_state.saturation);
-                } break;
-                
-                case 'B':
-                {
-                    // simple benchmark
-                    f32 lowest_time = 10000.f;
-                    f32 total_time = 0;
-                    int loop_count = 245;
-                    
-                    s64 last = time_perf();
-                    for (int i = 0; i < loop_count; i += 1)
-                    {
-                        convert_image(buffer->width, buffer->height, buffer->memory,
-                                      app_state.saturation);
-                        
-                        s64 now = time_perf();
-                        f32 elapsed = time_elapsed(now, last);
-                        last = now;
-                        
-                        if (elapsed < lowest_time) {
-                            lowest_time = elapsed;
-                        }
-                        
-                        total_time += elapsed;
-                    }
-                    
-                    
-                    f32 average_time = total_time / (f32)loop_count;
-                    
-                    snprintf(app_state.benchmark_text, sizeof(app_state.benchmark_text),
-                             "Lowest: %.3fms\nAverage: %.3fms\nTotal: %.3fms\n",
-                             lowest_time*1000.f, average_time*1000.f, total_time*1000.f);
-                    OutputDebugStringA(app_state.benchmark_text);
-                } break;
-                
-                case 'R':
-                {
-                    reload_default_image();
-                    app_state.benchmark_text[0] = 0;
-                } break;
-                
-                case VK_OEM_4: // [
-                {
-                    app_state.saturation -= 0.1f;
-                    if (app_state.saturation < 0.f)
-                    {
-                        app_state.saturation = 0.f;
-                    }
-                } break;
-                
-                case VK_OEM_6: // ]
-                {
-                    app_state.saturation += 0.1f;
-                } break;
-                
-                case VK_BACK: // backspace
-                {
-                    app_state.saturation = 1.f;
-                } break;
-                
-                case '1': {
-                    image_swap_bytes_between_rgba_and_bgra(buffer->width, buffer->height, buffer->memory);
-                } break;
-                
-                case '2': {
-                    image_flip_vertically(buffer->width, buffer->height, buffer->memory);
-                } break;
-                
-                case '3': {
-                    image_saturate(buffer->width, buffer->height, buffer->memory,
-                                   app_state.saturation, Saturation_Hsv);
-                } break;
-                
-                case '4': {
-                    image_saturate(buffer->width, buffer->height, buffer->memory,
-                                   app_state.saturation, Saturation_Hsl);
-                } break;
-                
-                case '5': {
-                    image_saturate(buffer->width, buffer->height, buffer->memory,
-                                   app_state.saturation, Saturation_Luminance_Srgb);
-                } break;
-                
-                case '6': {
-                    image_saturate(buffer->width, buffer->height, buffer->memory,
-                                   app_state.saturation, Saturation_Luminance_Linear);
-                } break;
-            }
-        } break;
+            return false;
+        }
         
-        default:
+        if (line[length] == '\n')
         {
-            result = DefWindowProcW(window, message, wParam, lParam);
-        } break;
+            line[length] = 0;
+            return true;
+        }
     }
-    return result;
+    return false;
 }
 
-
-
-
-
-static b32 debug_equals(f32 a, f32 b)
+// "YUV4MPEG2 W640 H480 F30:1 Ip A1:1 C420jpeg" - only the size and chroma format matter here
+static b32 stream_read_y4m_header(Stream_State *stream)
 {
-    f32 epsilon = 0.01f; // for float numerical precision + my test input data wasn't too precise either
-    b32 result = (a - epsilon <= b && a + epsilon >= b);
+    char line[Stream_Max_Header_Length];
+    if (!stream_read_line(stream->input, line, sizeof(line)) || strncmp(line, "YUV4MPEG2 ", 10) != 0)
+    {
+        return false;
+    }
+    
+    b32 is_420 = true; // no C parameter means 4:2:0
+    for (char *token = strtok(line + 10, " "); token; token = strtok(nullptr, " "))
+    {
+        switch (token[0])
+        {
+            case 'W': stream->width = (u32)atoi(token + 1); break;
+            case 'H': stream->height = (u32)atoi(token + 1); break;
+            case 'C':
+            {
+                // 8-bit 4:2:0 only - C420p10 and the other high bit depth formats have 2 bytes per sample
+                char *chroma = token + 1;
+                is_420 = (strcmp(chroma, "420") == 0 || strcmp(chroma, "420jpeg") == 0 ||
+                          strcmp(chroma, "420paldv") == 0 || strcmp(chroma, "420mpeg2") == 0);
+            } break;
+        }
+    }
+    
+    b32 result = (is_420 && stream->width && stream->height);
     return result;
 }
 
-static b32 debug_equals(v3 a, v3 b)
+static b32 stream_read_frame(Stream_State *stream, u8 *destination)
 {
-    b32 result = (debug_equals(a.x, b.x) &&
-                  debug_equals(a.y, b.y) &&
-                  debug_equals(a.z, b.z));
+    if (stream->is_y4m)
+    {
+        char line[Stream_Max_Header_Length];
+        if (!stream_read_line(stream->input, line, sizeof(line)) || strncmp(line, "FRAME", 5) != 0)
+        {
+            return false;
+        }
+    }
+    
+    b32 result = (read_file_all(stream->input, destination, stream->input_frame_size) == stream->input_frame_size);
     return result;
 }
 
-static void debug_conversion_tests()
+static DWORD WINAPI stream_reader_thread(void *parameter)
 {
-    // I think that tests are useful for this kind of code in general
-    // but besides that - I made some mistakes and needed to find & debug them
+    Stream_State *stream = (Stream_State *)parameter;
+    for (u64 i = 0;; i += 1)
     {
-        Color_Hsl hsl_values[] =
+        Stream_Slot *slot = &stream->slots[i % Stream_Slot_Count];
+        WaitForSingleObject(stream->free_slots, INFINITE);
+        
+        b32 end = (stream->write_failed || !stream_read_frame(stream, slot->input));
+        slot->end = end;
+        ReleaseSemaphore(stream->read_slots, 1, nullptr);
+        
+        if (end)
         {
-            {0,0,0}, {0.5f,0,0}, {0,0.5f,0}, {0,0,0.5f},
-            {0,0.5f,0.5f}, {0.5f,0.5f,0.9f},
-            {0.475f, 0.66f, 0.77f},
-        };
-        v3 rgb_values[] =
+            break;
+        }
+    }
+    return 0;
+}
+
+static DWORD WINAPI stream_writer_thread(void *parameter)
+{
+    Stream_State *stream = (Stream_State *)parameter;
+    for (u64 i = 0;; i += 1)
+    {
+        Stream_Slot *slot = &stream->slots[i % Stream_Slot_Count];
+        WaitForSingleObject(stream->converted_slots, INFINITE);
+        
+        if (slot->end)
         {
-            {0,0,0}, {0,0,0}, {0,0,0}, {0.5f,0.5f,0.5f},
-            {0.75f,0.25f,0.25f}, {0.8509f,0.94901f,0.94901f},
-            {0.619607f, 0.921568f, 0.874509f},
-        };
-        static_assert(array_count(hsl_values) == array_count(rgb_values), "Expected the same array counts");
+            break;
+        }
         
+        if (!stream->write_failed && !write_file_all(stream->output, slot->pixels, stream->output_frame_size))
+        {
+            stream->write_failed = true;
+        }
+        ReleaseSemaphore(stream->free_slots, 1, nullptr);
+    }
+    return 0;
+}
+
+static void stream_convert_frames(Stream_State *stream)
+{
+    for (u64 i = 0;; i += 1)
+    {
+        Stream_Slot *slot = &stream->slots[i % Stream_Slot_Count];
+        WaitForSingleObject(stream->read_slots, INFINITE);
         
-        for (u64 i = 0; i < array_count(hsl_values); i += 1)
+        // the slot belongs to the next stages as soon as it is released
+        b32 end = slot->end;
+        if (!end)
         {
-            v3 result = rgb_from_hsl(hsl_values[i]);
-            assert(debug_equals(result, rgb_values[i]));
+            s64 start = time_perf();
+            if (stream->is_y4m)
+            {
+                Yuv_Frame frame = yuv_frame_from_memory(Yuv_I420, stream->width, stream->height, slot->input);
+                convert_yuv_image(&frame, stream->width, stream->height, stream->saturation, slot->pixels);
+            }
+            else
+            {
+                // no R/B swap, so BGRA frames come out as BGRA like the y4m ones
+                u32 ops = Convert_Flip | Convert_Saturate | (stream->premultiplied ? Convert_Premultiplied : 0);
+                convert_image_ops(stream->width, stream->height, slot->pixels, ops, stream->saturation, nullptr);
+            }
+            stream->convert_time += time_elapsed(time_perf(), start);
+            stream->frame_count += 1;
         }
         
-        for (u64 i = 0; i < array_count(hsl_values); i += 1)
+        ReleaseSemaphore(stream->converted_slots, 1, nullptr);
+        if (end)
         {
-            Color_Hsl expected = hsl_values[i];
-            
-            Color_Hsl result = hsl_from_rgb(rgb_values[i]);
-            assert(debug_equals(result.vec, expected.vec) ||
-                   (expected.l == 0.f && result.l == 0.f));
+            break;
         }
     }
+}
+
+// task1.exe -stream [-saturation value] [-premultiplied] <width>x<height> | y4m
+static int run_stream(int arg_count, char **args)
+{
+    Stream_State stream = {};
+    stream.saturation = 1.f;
     
+    if (arg_count >= 2 && strcmp(args[0], "-saturation") == 0)
+    {
+        stream.saturation = pick_bigger((f32)atof(args[1]), 0.f);
+        arg_count -= 2;
+        args += 2;
+    }
     
+    if (arg_count >= 1 && strcmp(args[0], "-premultiplied") == 0)
     {
-        Color_Hsv hsv_values[] =
+        stream.premultiplied = true;
+        arg_count -= 1;
+        args += 1;
+    }
+    
+    if (arg_count != 1)
+    {
+        fprintf(stderr, "usage: task1.exe -stream [-saturation value] [-premultiplied] <width>x<height> | y4m\n");
+        return 1;
+    }
+    
+    stream.input = GetStdHandle(STD_INPUT_HANDLE);
+    stream.output = GetStdHandle(STD_OUTPUT_HANDLE);
+    stream.is_y4m = (strcmp(args[0], "y4m") == 0);
+    
+    if (stream.is_y4m)
+    {
+        if (!stream_read_y4m_header(&stream))
         {
-            {0,0,0}, {0.5f,0,0}, {0,0.5f,0}, {0,0,0.5f},
-            {0,0.5f,0.5f}, {0.5f,0.5f,0.9f},
-            {0.475f, 0.66f, 0.77f},
-        };
-        v3 rgb_values[] =
+            fprintf(stderr, "stdin is not an 8-bit 4:2:0 YUV4MPEG2 stream (C420, C420jpeg, C420paldv or C420mpeg2)\n");
+            return 1;
+        }
+        stream.input_frame_size = yuv_frame_size(stream.width, stream.height);
+    }
+    else
+    {
+        if (sscanf(args[0], "%ux%u", &stream.width, &stream.height) != 2 || !stream.width || !stream.height)
         {
-            {0,0,0}, {0,0,0}, {0,0,0}, {0.5f,0.5f,0.5f},
-            {0.5f,0.25f,0.25f}, {0.45098f,0.90196f,0.90196f},
-            {0.262745f, 0.768627f, 0.694118f},
-        };
-        static_assert(array_count(hsv_values) == array_count(rgb_values), "Expected the same array counts");
-        
-        
-        for (u64 i = 0; i < array_count(hsv_values); i += 1)
+            fprintf(stderr, "bad frame size: %s\n", args[0]);
+            return 1;
+        }
+        stream.input_frame_size = (u64)stream.width*stream.height*sizeof(u32);
+    }
+    stream.output_frame_size = (u64)stream.width*stream.height*sizeof(u32);
+    
+    for (u32 i = 0; i < Stream_Slot_Count; i += 1)
+    {
+        Stream_Slot *slot = &stream.slots[i];
+        slot->pixels = image_pool_acquire(&image_pool, stream.output_frame_size);
+        slot->input = (u8 *)slot->pixels;
+        if (stream.is_y4m)
         {
-            v3 result = rgb_from_hsv(hsv_values[i]);
-            assert(debug_equals(result, rgb_values[i]));
+            slot->input = (u8 *)image_pool_acquire(&image_pool, stream.input_frame_size);
         }
         
-        for (u64 i = 0; i < array_count(hsv_values); i += 1)
+        if (!slot->pixels || !slot->input)
         {
-            Color_Hsv expected = hsv_values[i];
-            
-            Color_Hsv result = hsv_from_rgb(rgb_values[i]);
-            assert(debug_equals(result.vec, expected.vec) ||
-                   (expected.v == 0.f && result.v == 0.f));
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+    
+    stream.free_slots = CreateSemaphoreA(nullptr, Stream_Slot_Count, Stream_Slot_Count, nullptr);
+    stream.read_slots = CreateSemaphoreA(nullptr, 0, Stream_Slot_Count, nullptr);
+    stream.converted_slots = CreateSemaphoreA(nullptr, 0, Stream_Slot_Count, nullptr);
+    
+    s64 start = time_perf();
+    HANDLE threads[2] = {
+        CreateThread(nullptr, 0, stream_reader_thread, &stream, 0, nullptr),
+        CreateThread(nullptr, 0, stream_writer_thread, &stream, 0, nullptr),
+    };
+    if (!threads[0] || !threads[1])
+    {
+        fprintf(stderr, "failed to start the stream threads\n");
+        ExitProcess(1);
+    }
+    
+    stream_convert_frames(&stream);
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    f32 total_time = time_elapsed(time_perf(), start);
+    
+    CloseHandle(threads[0]);
+    CloseHandle(threads[1]);
+    CloseHandle(stream.free_slots);
+    CloseHandle(stream.read_slots);
+    CloseHandle(stream.converted_slots);
+    for (u32 i = 0; i < Stream_Slot_Count; i += 1)
+    {
+        Stream_Slot *slot = &stream.slots[i];
+        if (slot->input != (u8 *)slot->pixels)
+        {
+            image_pool_release(&image_pool, slot->input, stream.input_frame_size);
         }
+        image_pool_release(&image_pool, slot->pixels, stream.output_frame_size);
     }
+    
+    // stdout carries the frames
+    fprintf(stderr, "Frames: %u\nConvert time: %.3fms (%.3fms per frame)\nTotal time: %.3fms\n",
+            stream.frame_count, stream.convert_time*1000.f,
+            (stream.frame_count ? stream.convert_time*1000.f / stream.frame_count : 0.f), total_time*1000.f);
+    
+    return (stream.write_failed ? 1 : 0);
 }
 
 
 
 
-
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
 {
     debug_conversion_tests();
     
-    reload_default_image();
+    // task1.exe [image path]
+    // task1.exe -batch [-saturation value] [-cache] [-packed] [-gray] paths...
+    // task1.exe -stream [-saturation value] <width>x<height> | y4m
+    app_state.image_path = "image.png";
+    if (__argc > 1)
+    {
+        if (strcmp(__argv[1], "-batch") == 0)
+        {
+            return run_batch(__argc - 2, __argv + 2);
+        }
+        if (strcmp(__argv[1], "-stream") == 0)
+        {
+            return run_stream(__argc - 2, __argv + 2);
+        }
+        
+        app_state.image_path = __argv[1];
+    }
+    
+    reload_default_image(image_pool.flags);
     app_state.saturation = 1.f;
     
     
@@ -717,9 +6257,34 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int n
     
     for(;;)
     {
-        char text_buffer[256];
-        snprintf(text_buffer, sizeof(text_buffer), "saturation: %.2f\n%s",
-                 app_state.saturation, app_state.benchmark_text);
+        char *large_pages_text = "";
+        if (image_pool.flags & Image_Pool_Large_Pages)
+        {
+            large_pages_text = (image_pool.large_page_fallback_count ?
+                                "large pages: on (unavailable)\n" : "large pages: on\n");
+        }
+        
+        char text_buffer[1024];
+        b32 mode_used = (!app_state.image.hdr.memory && !app_state.image.memory16 && !app_state.image.memory24);
+        char stats_text[128] = "";
+        if (app_state.stats_valid)
+        {
+            Image_Stats *stats = &app_state.stats;
+            snprintf(stats_text, sizeof(stats_text), "mean luminance: %.1f, mean chroma: %.1f, clipped: %.2f%%\n",
+                     image_stats_mean_luminance(stats), image_stats_mean_chroma(stats),
+                     (stats->pixel_count ? 100.f*(f32)stats->clipped_count/(f32)stats->pixel_count : 0.f));
+        }
+        
+        snprintf(text_buffer, sizeof(text_buffer), "%s: %.2f%s\ndecode: %.3fms\n%s%s%s%s%s%s%s",
+                 (app_state.vibrance ? "vibrance" : app_state.linear_light ? "saturation (linear light)" : "saturation"),
+                 app_state.saturation,
+                 (((app_state.vibrance || app_state.linear_light) && !mode_used) ? " (plain saturation for this image)" : ""),
+                 app_state.image.decode_time*1000.f, large_pages_text,
+                 ((image_pool.flags & Image_Pool_Prefault) ? "prefault: on\n" : ""),
+                 (app_state.use_pixel_cache ? "pixel cache: on\n" : ""),
+                 (app_state.chroma.memory ? "scrub: on\n" : ""),
+                 (app_state.packed_24 ? (app_state.image.memory24 ? "packed 24-bit: on\n" : "packed 24-bit: on (not used for this image)\n") : ""),
+                 stats_text, app_state.benchmark_text);
         
         HDC device_context = GetDC(app_state.window);
         display_gdi_buffer(app_state.window, device_context, &app_state.buffer, text_buffer);